@@ -3,18 +3,205 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 
 #define BLOCK_SIZE (size_t)65536 // 64KB
 #define MAX_WORD_SIZE (size_t)190
 #define INDEX_MEMORY_SIZE (size_t)(128 * 1024 * 1024) // 128MB
-#define MAX_BLOCKS 1000 // Maximum number of blocks for one term- overestimating
+
+// on-disk posting formats, recorded in the lexicon header so the query
+// processor knows how to decode the docID blocks
+#define INDEX_VERSION_RAW 1  // docIDs stored as raw varbytes (HW2 indexes)
+#define INDEX_VERSION_DGAP 2 // docIDs stored as gaps from the previous posting,
+                             // the first posting of each block is absolute
+#define INDEX_VERSION_SKIPS 3 // d-gaps, plus a binary skip table per term at
+                              // the end of the index file instead of the
+                              // last docIDs in the lexicon
+#define INDEX_VERSION_SUBSKIPS 4 // version 3, plus a skip entry for every
+                                 // SUB_BLOCK_SIZE postings inside a block
+#define INDEX_VERSION_BLOCKMAX 5 // version 4, plus the largest BM25 score of
+                                 // every sub-block and of every term
+#define INDEX_VERSION_BITMAP 6 // version 5, with the docIDs of dense terms
+                               // as Roaring containers instead of in the
+                               // blocks
+#define INDEX_VERSION_INLINE 7 // version 6, with the postings of terms in at
+                               // most INLINE_POSTINGS documents in their
+                               // lexicon records instead of in the blocks
+
+int index_version = INDEX_VERSION_INLINE; // format the generator writes
+
+// block codecs, chosen at build time and also recorded in the lexicon header
+#define CODEC_VARBYTE 0 // one varbyte per docID (or gap) and per frequency
+#define CODEC_BP128 1   // packs of 128 gaps/frequencies bit-packed for SIMD
+                        // unpacking, with PForDelta-style exceptions
+#define CODEC_STREAMVBYTE 2 // packs of 128 gaps/frequencies in Stream VByte:
+                            // 2-bit length codes split from the data bytes
+#define CODEC_ELIAS_FANO 3  // packs of 128 docIDs in Elias-Fano, each pack a
+                            // partition of the list, and frequencies in BP128
+#define PACK_SIZE 128   // number of postings in a full pack
+#define MAX_PACK_BYTES 2048 // worst case size of one encoded pack
+#define SUB_BLOCK_SIZE PACK_SIZE // postings per intra-block skip entry, the
+                                 // same as a pack so packs line up with them
+#define MAX_BLOCK_POSTINGS (BLOCK_SIZE * 4) // most postings of a term in one
+                                            // block, the size of the query
+                                            // processor's decode buffers
+
+int index_codec = CODEC_VARBYTE; // codec the generator writes
+
+// from version 6 on, a term in at least 1 of every BITMAP_DENSITY docIDs
+// keeps only its frequencies in the blocks. its docIDs follow its skip tables
+// as Roaring containers, one for every 65536 docIDs with any of them: a
+// bitmap, or a sorted array of the low 16 bits when the container has at
+// most ARRAY_CONTAINER_MAX docIDs. both start at an 8-byte aligned offset
+#define BITMAP_DENSITY 8
+#define ARRAY_CONTAINER_MAX 4096
+#define BITMAP_CONTAINER_BYTES 8192 // 65536 bits
+
+typedef struct {
+    size_t offset;   // where the container's bitmap or array starts,
+                     // relative to the skip tables section
+    int key;         // high 16 bits of the container's docIDs
+    int cardinality; // number of docIDs in the container
+    int rank;        // number of the term's docIDs in earlier containers
+    int unused;      // keeps the struct free of padding
+} RoaringContainer;
+
+// with -i <bits>, the frequencies are replaced by each posting's BM25 score
+// quantized to 8 or 16 bits, so the query processor sums integers instead of
+// evaluating BM25. 0 keeps the raw frequencies
+int impact_bits = 0;
+
+// with -s, impacts.dat is written too: every term's postings grouped into
+// segments of equal impact, highest first, for score-at-a-time evaluation
+// (Lin and Trotman's JASS). the file is an ImpactsHeader, the terms'
+// segment lists, then the offset of each term's list by term_id (one size_t
+// per term). a segment list is the number of segments (an unsigned int),
+// its ImpactSegments by decreasing impact, then the docIDs of each segment
+// in increasing order as varbyte gaps, the first one from 0
+#define IMPACTS_MAGIC "IMPBIN1" // 8 bytes with the terminating NUL
+
+typedef struct {
+    char magic[8];
+    size_t num_terms;        // number of terms in the directory
+    size_t directory_offset; // where the offsets by term_id start
+} ImpactsHeader;
+
+typedef struct {
+    unsigned int impact; // quantized impact of every posting in the segment
+    unsigned int count;  // number of postings
+    unsigned int size;   // bytes of varbyte gaps
+} ImpactSegment;
+
+int impact_segments = 0; // set by -s
+FILE *fimpacts = NULL;   // impacts.dat while it is written
+size_t *impact_offsets = NULL; // segment list of each lexicon record
+#define BM25_K1 1.2 // free parameter
+#define BM25_B 0.75 // free parameter
 
 typedef struct {
     size_t size;
     unsigned char *data; // Using unsigned char for byte-level operations
 } MemoryBlock;
 
+// one entry of a term's skip table, for each block its postings span
+typedef struct {
+    int max_did;     // last docID of the term in the block
+    int count;       // number of postings of the term in the block
+    size_t d_offset; // byte offset in final_index.dat of the term's first
+                     // docID in the block
+    size_t f_offset; // byte offset of the term's first frequency in the block
+} SkipEntry;
+
+// intra-block skip entry, one for every SUB_BLOCK_SIZE postings of a term in
+// a block. the first posting of a sub-block is a gap from the last docID of
+// the previous sub-block (absolute for the first sub-block of a block)
+typedef struct {
+    int max_did;             // last docID in the sub-block
+    unsigned short d_offset; // offset of the sub-block's first docID from the
+                             // block's SkipEntry d_offset
+    unsigned short f_offset; // same for the frequencies
+} SubSkipEntry;
+
+// binary lexicon written from version 3 on: a LexiconHeader, one
+// LexiconRecord per term, the minimal perfect hash seeds (one unsigned int
+// per bucket), then the front-coded term dictionary: the record slot of every
+// term in sorted order (one unsigned int per term), the offset of every block
+// of DICT_BLOCK_SIZE terms (one unsigned int per block) and the blocks. each
+// record sits in the slot the perfect hash gives its term. the query
+// processor mmaps the file as is, so the layout must match its copy of these
+// structs and of hash_term/mph_slot
+#define LEXICON_MAGIC "LEXBIN6" // 8 bytes with the terminating NUL
+#define MPH_BUCKET_SIZE 4       // average number of terms per hash bucket
+#define DICT_BLOCK_SIZE 16      // terms per front-coded dictionary block
+
+typedef struct {
+    char magic[8];
+    int version;        // format of final_index.dat
+    int codec;          // codec of final_index.dat
+    size_t num_terms;   // number of records
+    size_t num_buckets; // number of minimal perfect hash seeds
+    size_t dict_size;   // size of the front-coded blocks in bytes
+    double impact_scale; // BM25 score of one quantized impact unit, 0 when
+                         // the index stores frequencies
+} LexiconHeader;
+
+#define INLINE_POSTINGS 3 // postings that fit in place of the block offsets
+
+typedef struct {
+    size_t skip_offset;   // where the term's skip table starts, relative to
+                          // the skip tables section of the index file
+    unsigned int term_id; // position of the term in the sorted dictionary
+    int num_entries;          // number of documents containing the term
+    union {
+        struct {
+            int start_d_block; // block number where the first docID resides
+            int last_d_block;  // block number where the last docID resides
+            unsigned int start_d_offset; // offsets within a block,
+            unsigned int start_f_offset; // BLOCK_SIZE fits in 32 bits
+            unsigned int last_d_offset;
+            unsigned int last_f_offset;
+        };
+        struct {
+            // the postings of an inline term (num_blocks is 0), version 7
+            int inline_doc_ids[INLINE_POSTINGS];
+            int inline_freqs[INLINE_POSTINGS];
+        };
+    };
+    int last_did;   // the last docID of the term
+    unsigned int num_blocks; // number of blocks the term's posting list
+                             // spans, 0 for an inline term
+    float max_score; // largest BM25 score of the term in any document, 0
+                     // before version 5
+    unsigned int num_containers; // Roaring containers of the term's docIDs,
+                                 // 0 when they are in the blocks
+} LexiconRecord;
+
+// binary doc table: a DocTableHeader with the collection statistics BM25
+// needs, then the length of every docID up to the largest one (0 for docIDs
+// not in the collection). the query processor mmaps it as is
+#define DOC_TABLE_MAGIC "DOCBIN1" // 8 bytes with the terminating NUL
+
+typedef struct {
+    char magic[8];
+    size_t num_docs;     // number of documents in the collection
+    size_t table_size;   // number of lengths, the largest docID + 1
+    size_t total_length; // sum of the document lengths
+    double avg_length;   // average document length
+} DocTableHeader;
+
+// quantized norms: a NormsHeader, then one byte per docID encoding the
+// document length the way Lucene's SmallFloat.intToByte4 does, exact up to
+// 23 and with a 3-bit mantissa above. 35MB of lengths become 9MB of bytes
+// that mostly stay in cache while scoring
+#define NORMS_MAGIC "NRMBIN1" // 8 bytes with the terminating NUL
+#define NORMS_FREE_VALUES 24  // byte values that hold the length as is
+
+typedef struct {
+    char magic[8];
+    size_t table_size; // number of norms, the largest docID + 1
+} NormsHeader;
+
 typedef struct {
     char *term;
     int count;
@@ -30,8 +217,29 @@ typedef struct {
     size_t last_f_offset; // Offset within the block where the last frequency
                           // is stored
     int last_did;         // the last docID of the term
-    int *last;            // Array to store the last docID in each block
+    SkipEntry *skips;     // skip table, one entry per block
+    size_t skips_capacity;
+    size_t num_skips;  // number of skip entries filled in so far
+    SubSkipEntry *sub_skips; // intra-block skip entries for all blocks
+    float *sub_max_scores;   // largest BM25 score in each sub-block, same
+                             // capacity as sub_skips
+    size_t sub_skips_capacity;
+    size_t num_sub_skips;
+    float max_score; // largest BM25 score of the term
     size_t num_blocks; // Number of d blocks that the term's posting list spans
+    int *doc_ids;      // docIDs of a term stored as Roaring containers, NULL
+                       // for the others
+    size_t num_doc_ids;
+    size_t doc_ids_capacity;
+    size_t num_containers;
+    int inline_term; // whether the postings go to the lexicon record
+    int inline_doc_ids[INLINE_POSTINGS];
+    int inline_freqs[INLINE_POSTINGS];
+    size_t num_inline;
+    int *impact_doc_ids; // postings of the term for its impact segments,
+    int *impacts;        // NULL without -s
+    size_t num_impacts;
+    size_t impacts_capacity;
 } LexiconEntry;
 
 typedef struct {
@@ -47,6 +255,26 @@ typedef struct {
 
 TermEntry *terms = NULL; // Hash table
 
+// records and terms of the binary lexicon, kept in memory until all terms
+// are known to build the perfect hash and the dictionary over them
+LexiconRecord *lexicon_records = NULL;
+size_t *lexicon_term_offsets = NULL; // term of each record in lexicon_pool
+size_t num_lexicon_records = 0;
+size_t lexicon_records_capacity = 0;
+char *lexicon_pool = NULL;
+size_t lexicon_pool_size = 0;
+size_t lexicon_pool_capacity = 0;
+
+// postings of the current term that are waiting to be written as a pack
+typedef struct {
+    int doc_ids[PACK_SIZE];
+    int freqs[PACK_SIZE];
+    size_t size;
+    float max_score; // largest score bound of the postings in the pack
+} PostingPack;
+
+PostingPack pending_pack;
+
 // this function reads the words_out file and populates the terms hash table
 // with the terms and their counts
 void read_words_out(const char *filename) {
@@ -68,6 +296,196 @@ void read_words_out(const char *filename) {
     fclose(file);
 }
 
+// encodes a positive value as 3 mantissa bits below an implicit leading bit
+// and the exponent above them, rounding down (Lucene's SmallFloat.longToInt4)
+int long_to_int4(unsigned int value) {
+    int num_bits = 32 - __builtin_clz(value);
+    if (num_bits < 4) {
+        return value; // subnormal value
+    }
+    int shift = num_bits - 4;
+    return ((value >> shift) & 0x07) | ((shift + 1) << 3);
+}
+
+// one byte norm of a document length
+unsigned char length_to_norm(int length) {
+    if (length < NORMS_FREE_VALUES) {
+        return length < 0 ? 0 : length;
+    }
+    return NORMS_FREE_VALUES + long_to_int4(length - NORMS_FREE_VALUES);
+}
+
+// this function writes the quantized norms of the doc table lengths
+void write_norms(const char *filename, const int *lengths, size_t table_size) {
+    unsigned char *norms = malloc(table_size ? table_size : 1);
+    if (!norms) {
+        perror("Error allocating memory for norms");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < table_size; i++) {
+        norms[i] = length_to_norm(lengths[i]);
+    }
+    NormsHeader header;
+    memset(&header, 0, sizeof(NormsHeader));
+    memcpy(header.magic, NORMS_MAGIC, sizeof(header.magic));
+    header.table_size = table_size;
+
+    FILE *fnorms = fopen(filename, "wb");
+    if (!fnorms) {
+        perror("Error opening norms.bin");
+        exit(EXIT_FAILURE);
+    }
+    if (fwrite(&header, sizeof(NormsHeader), 1, fnorms) != 1 ||
+        fwrite(norms, 1, table_size, fnorms) != table_size) {
+        perror("Error writing norms");
+        exit(EXIT_FAILURE);
+    }
+    fclose(fnorms);
+    free(norms);
+}
+
+// document lengths and collection statistics, kept after the doc table is
+// written to compute the impacts
+int *doc_lengths = NULL;
+size_t num_docs = 0;
+size_t doc_id_range = 0; // largest docID + 1
+double avg_doc_length = 0;
+double impact_scale = 0; // BM25 score of one impact unit
+
+// this function reads the docID and length pairs of docs_out.txt and writes
+// them as the binary doc table, with the number of documents and the average
+// length in the header so every collection is scored with its own statistics.
+// the quantized norms are written from the same lengths
+void write_doc_table(const char *docs_file, const char *table_file) {
+    FILE *file = fopen(docs_file, "r");
+    if (!file) {
+        perror("Failed to open docs_out.txt");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t capacity = 1024;
+    int *lengths = calloc(capacity, sizeof(int));
+    if (!lengths) {
+        perror("Error allocating memory for doc table");
+        exit(EXIT_FAILURE);
+    }
+    DocTableHeader header;
+    memset(&header, 0, sizeof(DocTableHeader));
+    memcpy(header.magic, DOC_TABLE_MAGIC, sizeof(header.magic));
+    int doc_id, doc_length;
+    while (fscanf(file, "%d %d", &doc_id, &doc_length) == 2) {
+        if (doc_id < 0) {
+            fprintf(stderr, "Invalid docID in %s: %d\n", docs_file, doc_id);
+            exit(EXIT_FAILURE);
+        }
+        while ((size_t)doc_id >= capacity) {
+            lengths = realloc(lengths, sizeof(int) * capacity * 2);
+            if (!lengths) {
+                perror("Error reallocating memory for doc table");
+                exit(EXIT_FAILURE);
+            }
+            memset(lengths + capacity, 0, sizeof(int) * capacity);
+            capacity *= 2;
+        }
+        lengths[doc_id] = doc_length;
+        if ((size_t)doc_id >= header.table_size) {
+            header.table_size = doc_id + 1;
+        }
+        header.num_docs++;
+        header.total_length += doc_length;
+    }
+    fclose(file);
+    if (header.num_docs > 0) {
+        header.avg_length = (double)header.total_length / header.num_docs;
+    }
+
+    FILE *ftable = fopen(table_file, "wb");
+    if (!ftable) {
+        perror("Error opening docs.bin");
+        exit(EXIT_FAILURE);
+    }
+    if (fwrite(&header, sizeof(DocTableHeader), 1, ftable) != 1 ||
+        fwrite(lengths, sizeof(int), header.table_size, ftable) !=
+            header.table_size) {
+        perror("Error writing doc table");
+        exit(EXIT_FAILURE);
+    }
+    fclose(ftable);
+    write_norms("norms.bin", lengths, header.table_size);
+    printf("Doc table: %zu documents, average length %.2f\n", header.num_docs,
+           header.avg_length);
+    doc_lengths = lengths;
+    num_docs = header.num_docs;
+    doc_id_range = header.table_size;
+    avg_doc_length = header.avg_length;
+
+    // no posting scores more than a term in a single document with a
+    // saturated frequency, so that bound maps to the largest impact
+    if (impact_bits) {
+        double max_score =
+            (BM25_K1 + 1.0) * log((num_docs - 1 + 0.5) / (1 + 0.5) + 1.0);
+        impact_scale = max_score / ((1 << impact_bits) - 1);
+    }
+}
+
+// length of a posting's document. a docID past the doc table means the
+// postings and docs_out.txt come from different collections
+int doc_length(int doc_id) {
+    if (doc_id < 0 || (size_t)doc_id >= doc_id_range) {
+        fprintf(stderr, "DocID %d is not in the doc table\n", doc_id);
+        exit(EXIT_FAILURE);
+    }
+    return doc_lengths[doc_id];
+}
+
+// BM25 score of a posting quantized to impact_bits, rounded to the nearest
+// step but at least 1 so every posting still counts
+int quantize_impact(int freq, int doc_id, int num_entries) {
+    double tf =
+        freq * (BM25_K1 + 1.0) /
+        (freq + BM25_K1 * (1.0 - BM25_B +
+                           BM25_B * (doc_length(doc_id) / avg_doc_length)));
+    double idf =
+        log(((double)num_docs - num_entries + 0.5) / (num_entries + 0.5) + 1.0);
+    int impact = (int)(tf * idf / impact_scale + 0.5);
+    return impact < 1 ? 1 : impact;
+}
+
+// decodes a value of long_to_int4, the smallest length that maps to it
+int int4_to_long(int value) {
+    int bits = value & 0x07;
+    int shift = (value >> 3) - 1;
+    return shift < 0 ? bits : (bits | 0x08) << shift;
+}
+
+// upper bound of a posting's BM25 score for the block-max skip entries. the
+// length is the one the document's norm stands for, which is never above the
+// exact length, so the bound also holds when the query processor scores with
+// norms. impact indexes score impact * impact_scale exactly. the bound is
+// rounded up to the next float so the query processor can compare sums of
+// bounds with its double scores
+float score_bound(int freq, int doc_id, int num_entries) {
+    double score;
+    if (impact_bits) {
+        score = freq * impact_scale;
+    } else {
+        unsigned char norm = length_to_norm(doc_length(doc_id));
+        int length = norm < NORMS_FREE_VALUES
+                         ? norm
+                         : NORMS_FREE_VALUES +
+                               int4_to_long(norm - NORMS_FREE_VALUES);
+        double tf = freq * (BM25_K1 + 1.0) /
+                    (freq + BM25_K1 * (1.0 - BM25_B +
+                                       BM25_B * (length / avg_doc_length)));
+        double idf = log(((double)num_docs - num_entries + 0.5) /
+                             (num_entries + 0.5) +
+                         1.0);
+        score = tf * idf;
+    }
+    float bound = (float)score;
+    return bound < score ? nextafterf(bound, INFINITY) : bound;
+}
+
 // this function writes the all of the blocks in memory to the index file on
 // disc
 void pipe_to_file(MemoryBlock *blocks, FILE *file) {
@@ -119,58 +537,989 @@ size_t varbyte_encode(int value, unsigned char *output) {
     return i;
 }
 
+// number of bits needed to store value
+int bits_needed(unsigned int value) {
+    return value ? 32 - __builtin_clz(value) : 0;
+}
+
+// this function encodes up to PACK_SIZE values as one BP128 pack:
+//   byte 0: n, the number of values in the pack
+// a full pack (n == PACK_SIZE) continues with
+//   byte 1: b, the bit width, and byte 2: e, the number of exceptions
+//   16 * b bytes: the low b bits of every value, packed into 4 interleaved
+//                 32-bit lanes (value i goes to lane i % 4) so the query
+//                 processor can unpack 4 values per SSE instruction
+//   e bytes: positions of the exceptions, the values that need more than b bits
+//   e varbytes: the high bits (value >> b) of each exception
+// a partial pack (the tail of a posting list) stores n plain varbytes instead
+size_t bp128_encode(const int *values, size_t n, unsigned char *output) {
+    size_t i = 0;
+    output[i++] = (unsigned char)n;
+    if (n < PACK_SIZE) {
+        for (size_t j = 0; j < n; j++) {
+            i += varbyte_encode(values[j], output + i);
+        }
+        return i;
+    }
+
+    // pick the bit width with the smallest encoded size, PForDelta style
+    unsigned char scratch[10];
+    int best_b = 32;
+    size_t best_size = (size_t)-1;
+    for (int b = 0; b <= 32; b++) {
+        size_t size = 16 * b;
+        for (size_t j = 0; j < PACK_SIZE; j++) {
+            if (bits_needed(values[j]) > b) {
+                size += 1 + varbyte_encode(values[j] >> b, scratch);
+            }
+        }
+        if (size < best_size) {
+            best_size = size;
+            best_b = b;
+        }
+    }
+
+    unsigned char num_exceptions = 0;
+    unsigned char exceptions[PACK_SIZE];
+    for (size_t j = 0; j < PACK_SIZE; j++) {
+        if (bits_needed(values[j]) > best_b) {
+            exceptions[num_exceptions++] = (unsigned char)j;
+        }
+    }
+    output[i++] = (unsigned char)best_b;
+    output[i++] = num_exceptions;
+
+    // bit-pack the low bits, each lane holds every 4th value
+    unsigned int words[4 * 32];
+    memset(words, 0, sizeof(unsigned int) * 4 * best_b);
+    unsigned int mask = best_b == 32 ? 0xFFFFFFFF : (1u << best_b) - 1;
+    for (int lane = 0; lane < 4; lane++) {
+        int bit = 0;
+        for (int r = 0; r < PACK_SIZE / 4; r++) {
+            unsigned int v = (unsigned int)values[4 * r + lane] & mask;
+            int word = bit / 32;
+            int shift = bit % 32;
+            words[4 * word + lane] |= v << shift;
+            if (shift + best_b > 32) {
+                words[4 * (word + 1) + lane] |= v >> (32 - shift);
+            }
+            bit += best_b;
+        }
+    }
+    memcpy(output + i, words, 16 * best_b);
+    i += 16 * best_b;
+
+    // patch list for the exceptions
+    memcpy(output + i, exceptions, num_exceptions);
+    i += num_exceptions;
+    for (int j = 0; j < num_exceptions; j++) {
+        i += varbyte_encode(values[exceptions[j]] >> best_b, output + i);
+    }
+    return i;
+}
+
+// this function encodes up to PACK_SIZE values as one Stream VByte pack:
+//   byte 0: n, the number of values in the pack
+//   (n + 3) / 4 control bytes: 2 bits per value holding its length in bytes
+//                              minus one, first value in the lowest bits
+//   data bytes: each value in 1-4 little-endian bytes
+// the index stays byte-aligned, but the query processor can decode 4 values
+// with one shuffle because the lengths are known before touching the data
+size_t streamvbyte_encode(const int *values, size_t n,
+                          unsigned char *output) {
+    output[0] = (unsigned char)n;
+    unsigned char *control = output + 1;
+    size_t num_control = (n + 3) / 4;
+    memset(control, 0, num_control);
+    size_t i = 1 + num_control;
+    for (size_t j = 0; j < n; j++) {
+        unsigned int v = (unsigned int)values[j];
+        int length = v < (1u << 8)    ? 1
+                     : v < (1u << 16) ? 2
+                     : v < (1u << 24) ? 3
+                                      : 4;
+        control[j / 4] |= (unsigned char)((length - 1) << (2 * (j % 4)));
+        for (int k = 0; k < length; k++) {
+            output[i++] = (unsigned char)(v >> (8 * k));
+        }
+    }
+    return i;
+}
+
+// this function encodes a pack of n docIDs, given as gaps from base (0 for
+// the first pack of a block, else the docID before the pack), in Elias-Fano:
+//   byte 0: n, byte 1: l, the number of low bits, and byte 2: w, the number
+//           of 64-bit words of upper bits
+//   (n * l + 7) / 8 bytes: the low l bits of every value (docID - base),
+//                          value i at bit i * l
+//   8 * w bytes: the upper bits in unary, value i sets bit (value >> l) + i
+// l is about log2(last value / n), so a pack takes at most 2 + l bits per
+// docID plus the header. the query processor finds the first docID >= k by
+// counting zeros in the upper bits (select) instead of decoding the pack
+size_t elias_fano_encode(const int *gaps, size_t n, unsigned char *output) {
+    unsigned int values[PACK_SIZE];
+    unsigned int value = 0;
+    for (size_t i = 0; i < n; i++) {
+        value += (unsigned int)gaps[i];
+        values[i] = value;
+    }
+    int l = 0;
+    while ((values[n - 1] + 1) >> (l + 1) >= n) {
+        l++;
+    }
+    size_t low_bytes = (n * l + 7) / 8;
+    size_t upper_bits = n + (values[n - 1] >> l);
+    size_t num_words = (upper_bits + 63) / 64;
+    output[0] = (unsigned char)n;
+    output[1] = (unsigned char)l;
+    output[2] = (unsigned char)num_words;
+    unsigned char *low = output + 3;
+    unsigned char *upper = low + low_bytes;
+    memset(low, 0, low_bytes + 8 * num_words);
+    for (size_t i = 0; i < n; i++) {
+        for (int b = 0; b < l; b++) {
+            size_t bit = i * l + b;
+            low[bit / 8] |= (unsigned char)(((values[i] >> b) & 1) << bit % 8);
+        }
+        size_t bit = (values[i] >> l) + i;
+        upper[bit / 8] |= (unsigned char)(1 << bit % 8);
+    }
+    return 3 + low_bytes + 8 * num_words;
+}
+
+// this function encodes a pack with the codec the index is built with, the
+// frequencies of an Elias-Fano index are BP128 packs
+size_t encode_pack(const int *values, size_t n, unsigned char *output) {
+    if (index_codec == CODEC_STREAMVBYTE) {
+        return streamvbyte_encode(values, n, output);
+    }
+    return bp128_encode(values, n, output);
+}
+
+// this function encodes a pack of docID gaps with the codec the index is
+// built with
+size_t encode_doc_pack(const int *gaps, size_t n, unsigned char *output) {
+    if (index_codec == CODEC_ELIAS_FANO) {
+        return elias_fano_encode(gaps, n, output);
+    }
+    return encode_pack(gaps, n, output);
+}
+
+// this function pads the current docids and freqs blocks to BLOCK_SIZE and
+// adds both to the index, so the next posting starts a new block
+void flush_blocks(MemoryBlock *docids, MemoryBlock *freqs,
+                  int *current_block_number, MemoryBlock *blocks, FILE *findex,
+                  LexiconEntry *current_entry) {
+    // pad docids block with 0s so it is a full BLOCK_SIZE sized block
+    if (docids->size < BLOCK_SIZE) {
+        memset(docids->data + docids->size, 0,
+               BLOCK_SIZE - docids->size); // pad with 0s
+        docids->size = BLOCK_SIZE;         // set size to BLOCK_SIZE
+    }
+    // pad frequency block with 0s so it is a full BLOCK_SIZE sized block
+    if (freqs->size < BLOCK_SIZE) {
+        memset(freqs->data + freqs->size, 0, BLOCK_SIZE - freqs->size);
+        freqs->size = BLOCK_SIZE; // set size to BLOCK_SIZE
+    }
+    add_to_index(docids, current_block_number, blocks, findex);
+    add_to_index(freqs, current_block_number, blocks, findex);
+    current_entry->num_blocks++;
+}
+
+// this function returns the last docID the current term has in the current
+// block, the base for the next d-gap. the first posting of a term uses 0
+int prev_doc_id_in_block(LexiconEntry *current_entry) {
+    if (current_entry->start_d_block == -1) {
+        return 0;
+    }
+    return current_entry->skips[current_entry->num_blocks].max_did;
+}
+
+// this function appends compressed docids and freqs of the current term to
+// the docids and freqs blocks, and keeps the term's skip table up to date
+void append_postings(MemoryBlock *docids, MemoryBlock *freqs,
+                     const unsigned char *doc_data, size_t doc_size,
+                     const unsigned char *freq_data, size_t freq_size,
+                     int last_doc_id, size_t num_postings, float max_score,
+                     int current_block_number, LexiconEntry *current_entry) {
+    if (current_entry->start_d_block == -1) {
+        // first posting of term is being inserted, set lexicon attributes
+        current_entry->start_d_block = current_block_number;
+        current_entry->start_d_offset = docids->size;
+        current_entry->start_f_offset = freqs->size;
+        current_entry->num_blocks = 0;
+    }
+
+    if (current_entry->num_skips == current_entry->num_blocks) {
+        // first postings of the term in this block, start a skip entry
+        if (current_entry->num_skips == current_entry->skips_capacity) {
+            current_entry->skips_capacity *= 2;
+            current_entry->skips =
+                realloc(current_entry->skips,
+                        sizeof(SkipEntry) * current_entry->skips_capacity);
+            if (!current_entry->skips) {
+                perror("Error growing skip table");
+                exit(EXIT_FAILURE);
+            }
+        }
+        SkipEntry *skip = &current_entry->skips[current_entry->num_skips++];
+        skip->count = 0;
+        skip->d_offset =
+            (size_t)current_block_number * BLOCK_SIZE + docids->size;
+        skip->f_offset =
+            (size_t)(current_block_number + 1) * BLOCK_SIZE + freqs->size;
+    }
+
+    SkipEntry *skip = &current_entry->skips[current_entry->num_blocks];
+    if (skip->count % SUB_BLOCK_SIZE == 0) {
+        // start a new sub-block, packs always start one
+        if (current_entry->num_sub_skips == current_entry->sub_skips_capacity) {
+            current_entry->sub_skips_capacity *= 2;
+            current_entry->sub_skips = realloc(
+                current_entry->sub_skips,
+                sizeof(SubSkipEntry) * current_entry->sub_skips_capacity);
+            current_entry->sub_max_scores =
+                realloc(current_entry->sub_max_scores,
+                        sizeof(float) * current_entry->sub_skips_capacity);
+            if (!current_entry->sub_skips || !current_entry->sub_max_scores) {
+                perror("Error growing sub-block skip table");
+                exit(EXIT_FAILURE);
+            }
+        }
+        current_entry->sub_max_scores[current_entry->num_sub_skips] = 0;
+        SubSkipEntry *sub_skip =
+            &current_entry->sub_skips[current_entry->num_sub_skips++];
+        sub_skip->d_offset = docids->size - skip->d_offset % BLOCK_SIZE;
+        sub_skip->f_offset = freqs->size - skip->f_offset % BLOCK_SIZE;
+    }
+
+    memcpy(docids->data + docids->size, doc_data, doc_size);
+    docids->size += doc_size;
+    memcpy(freqs->data + freqs->size, freq_data, freq_size);
+    freqs->size += freq_size;
+
+    skip->max_did = last_doc_id;
+    skip->count += num_postings;
+    current_entry->sub_skips[current_entry->num_sub_skips - 1].max_did =
+        last_doc_id;
+    float *sub_max_score =
+        &current_entry->sub_max_scores[current_entry->num_sub_skips - 1];
+    if (max_score > *sub_max_score) {
+        *sub_max_score = max_score;
+    }
+    if (max_score > current_entry->max_score) {
+        current_entry->max_score = max_score;
+    }
+}
+
+// this function encodes the pending pack of the current term and adds it to
+// the docids and freqs blocks, like insert_posting does for one posting
+void insert_pack(MemoryBlock *docids, MemoryBlock *freqs,
+                 int *current_block_number, MemoryBlock *blocks, FILE *findex,
+                 LexiconEntry *current_entry) {
+    if (pending_pack.size == 0) {
+        return;
+    }
+
+    unsigned char compressed_doc_data[MAX_PACK_BYTES];
+    unsigned char compressed_freq_data[MAX_PACK_BYTES];
+    int gaps[PACK_SIZE];
+
+    // gaps are taken from the last docID of the term in this block, the
+    // first pack of a term or of a block starts from 0 (absolute)
+    int prev_doc_id = prev_doc_id_in_block(current_entry);
+    for (size_t i = 0; i < pending_pack.size; i++) {
+        gaps[i] = pending_pack.doc_ids[i] - prev_doc_id;
+        prev_doc_id = pending_pack.doc_ids[i];
+    }
+    size_t compressed_doc_size =
+        current_entry->doc_ids
+            ? 0
+            : encode_doc_pack(gaps, pending_pack.size, compressed_doc_data);
+    size_t compressed_freq_size = encode_pack(
+        pending_pack.freqs, pending_pack.size, compressed_freq_data);
+
+    // packs of small gaps and frequencies take only a few bits per posting,
+    // so a block is also closed once the term has MAX_BLOCK_POSTINGS in it
+    size_t block_postings =
+        current_entry->num_skips > current_entry->num_blocks
+            ? current_entry->skips[current_entry->num_blocks].count
+            : 0;
+    if ((docids->size + compressed_doc_size) > BLOCK_SIZE ||
+        (freqs->size + compressed_freq_size) > BLOCK_SIZE ||
+        block_postings + pending_pack.size > MAX_BLOCK_POSTINGS) {
+        // pack doesn't fit, start new blocks and re-encode the pack so its
+        // first docID is absolute
+        flush_blocks(docids, freqs, current_block_number, blocks, findex,
+                     current_entry);
+        if (!current_entry->doc_ids) {
+            gaps[0] = pending_pack.doc_ids[0];
+            compressed_doc_size =
+                encode_doc_pack(gaps, pending_pack.size, compressed_doc_data);
+        }
+    }
+
+    append_postings(docids, freqs, compressed_doc_data, compressed_doc_size,
+                    compressed_freq_data, compressed_freq_size,
+                    pending_pack.doc_ids[pending_pack.size - 1],
+                    pending_pack.size, pending_pack.max_score,
+                    *current_block_number, current_entry);
+    pending_pack.size = 0;
+    pending_pack.max_score = 0;
+}
+
 // this function takes a doc_id and count, compresses the doc_id,
 // compresses the frequency, and adds both to the appropriate blocks
 void insert_posting(MemoryBlock *docids, MemoryBlock *freqs, int doc_id,
                     int count, int *current_block_number, MemoryBlock *blocks,
                     FILE *findex, LexiconEntry *current_entry) {
 
+    if (impact_bits) {
+        count = quantize_impact(count, doc_id, current_entry->num_entries);
+    }
+    if (current_entry->impacts) {
+        // kept for the term's impact segments too
+        if (current_entry->num_impacts == current_entry->impacts_capacity) {
+            current_entry->impacts_capacity *= 2;
+            current_entry->impact_doc_ids =
+                realloc(current_entry->impact_doc_ids,
+                        sizeof(int) * current_entry->impacts_capacity);
+            current_entry->impacts =
+                realloc(current_entry->impacts,
+                        sizeof(int) * current_entry->impacts_capacity);
+            if (!current_entry->impact_doc_ids || !current_entry->impacts) {
+                perror("Error growing postings of impact segments");
+                exit(EXIT_FAILURE);
+            }
+        }
+        current_entry->impact_doc_ids[current_entry->num_impacts] = doc_id;
+        current_entry->impacts[current_entry->num_impacts++] = count;
+    }
+    float max_score = 0;
+    if (index_version >= INDEX_VERSION_BLOCKMAX) {
+        max_score = score_bound(count, doc_id, current_entry->num_entries);
+    }
+    if (current_entry->inline_term) {
+        // the posting goes to the term's lexicon record, not to the blocks
+        if (current_entry->num_inline == INLINE_POSTINGS) {
+            fprintf(stderr, "Term %s has more postings than words_out.txt "
+                            "lists\n", current_entry->term);
+            exit(EXIT_FAILURE);
+        }
+        current_entry->inline_doc_ids[current_entry->num_inline] = doc_id;
+        current_entry->inline_freqs[current_entry->num_inline] = count;
+        current_entry->num_inline++;
+        if (max_score > current_entry->max_score) {
+            current_entry->max_score = max_score;
+        }
+        return;
+    }
+    if (current_entry->doc_ids) {
+        // the docID goes to the term's Roaring containers
+        if (current_entry->num_doc_ids == current_entry->doc_ids_capacity) {
+            current_entry->doc_ids_capacity *= 2;
+            current_entry->doc_ids =
+                realloc(current_entry->doc_ids,
+                        sizeof(int) * current_entry->doc_ids_capacity);
+            if (!current_entry->doc_ids) {
+                perror("Error growing docIDs of bitmap term");
+                exit(EXIT_FAILURE);
+            }
+        }
+        current_entry->doc_ids[current_entry->num_doc_ids++] = doc_id;
+    }
+
+    if (index_codec != CODEC_VARBYTE) {
+        // buffer the posting, it is compressed together with its pack
+        pending_pack.doc_ids[pending_pack.size] = doc_id;
+        pending_pack.freqs[pending_pack.size] = count;
+        pending_pack.size++;
+        if (max_score > pending_pack.max_score) {
+            pending_pack.max_score = max_score;
+        }
+        if (pending_pack.size == PACK_SIZE) {
+            insert_pack(docids, freqs, current_block_number, blocks, findex,
+                        current_entry);
+        }
+        return;
+    }
+
     size_t compressed_doc_size, compressed_freq_size;
     unsigned char compressed_doc_data[10];
     unsigned char compressed_freq_data[10];
 
-    // compress doc_id and add to docids
-    compressed_doc_size = varbyte_encode(doc_id, compressed_doc_data);
+    // in the d-gap format, store the distance from the previous posting of
+    // this term in the same block. the first posting of a term and the first
+    // posting of a block stay absolute so every block decodes on its own
+    int doc_value = doc_id;
+    if (index_version >= INDEX_VERSION_DGAP) {
+        doc_value = doc_id - prev_doc_id_in_block(current_entry);
+    }
+
+    // compress doc_id and add to docids, bitmap terms have no docID bytes
+    compressed_doc_size = current_entry->doc_ids
+                              ? 0
+                              : varbyte_encode(doc_value, compressed_doc_data);
 
     // compress count and add to freqs
     compressed_freq_size = varbyte_encode(count, compressed_freq_data);
 
-    if ((docids->size + compressed_doc_size) > BLOCK_SIZE) {
-        // doc ids block is full, put docids block and freqs block in index pad docids block with
-        // 0s so it is a full BLOCK_SIZE sized block
-        if (docids->size < BLOCK_SIZE) {
-            memset(docids->data + docids->size, 0,
-                   BLOCK_SIZE - docids->size); // pad with 0s
-            docids->size = BLOCK_SIZE;         // set size to BLOCK_SIZE
+    if ((docids->size + compressed_doc_size) > BLOCK_SIZE ||
+        (freqs->size + compressed_freq_size) > BLOCK_SIZE) {
+        // doc ids block is full (small gaps can also let the freqs block fill
+        // up first), put docids block and freqs block in index
+        flush_blocks(docids, freqs, current_block_number, blocks, findex,
+                     current_entry);
+
+        // first posting of the new block, so store the absolute docID
+        if (!current_entry->doc_ids) {
+            compressed_doc_size = varbyte_encode(doc_id, compressed_doc_data);
+        }
+    }
+
+    // add compressed docid and freq to docids and freqs blocks
+    append_postings(docids, freqs, compressed_doc_data, compressed_doc_size,
+                    compressed_freq_data, compressed_freq_size, doc_id, 1,
+                    max_score, *current_block_number, current_entry);
+}
+
+// this function adds a finished term to the binary lexicon, with skip_offset
+// pointing at its skip table
+void add_lexicon_record(LexiconEntry *current_entry, size_t skip_offset) {
+    if (num_lexicon_records == lexicon_records_capacity) {
+        lexicon_records_capacity =
+            lexicon_records_capacity ? lexicon_records_capacity * 2 : 1024;
+        lexicon_records =
+            realloc(lexicon_records,
+                    sizeof(LexiconRecord) * lexicon_records_capacity);
+        lexicon_term_offsets =
+            realloc(lexicon_term_offsets,
+                    sizeof(size_t) * lexicon_records_capacity);
+        if (fimpacts) {
+            impact_offsets = realloc(
+                impact_offsets, sizeof(size_t) * lexicon_records_capacity);
+            if (!impact_offsets) {
+                perror("Error reallocating memory for impact offsets");
+                exit(EXIT_FAILURE);
+            }
         }
-        // pad frequency block with 0s so it is a full BLOCK_SIZE sized block
-        if (freqs->size < BLOCK_SIZE) {
-            memset(freqs->data + freqs->size, 0, BLOCK_SIZE - freqs->size);
-            freqs->size = BLOCK_SIZE; // set size to BLOCK_SIZE
+        if (!lexicon_records || !lexicon_term_offsets) {
+            perror("Error reallocating memory for lexicon records");
+            exit(EXIT_FAILURE);
+        }
+    }
+    size_t term_length = strlen(current_entry->term) + 1;
+    while (lexicon_pool_size + term_length > lexicon_pool_capacity) {
+        lexicon_pool_capacity =
+            lexicon_pool_capacity ? lexicon_pool_capacity * 2 : 65536;
+        lexicon_pool = realloc(lexicon_pool, lexicon_pool_capacity);
+        if (!lexicon_pool) {
+            perror("Error reallocating memory for lexicon string pool");
+            exit(EXIT_FAILURE);
         }
-        add_to_index(docids, current_block_number, blocks, findex);
-        add_to_index(freqs, current_block_number, blocks, findex);
-        current_entry->num_blocks++;
     }
 
-    if (current_entry->start_d_block == -1) {
-        // first posting of term is being inserted, set lexicon attributes
-        current_entry->start_d_block = *current_block_number;
-        current_entry->start_d_offset = docids->size;
-        current_entry->start_f_offset = freqs->size;
-        current_entry->num_blocks = 0;
+    lexicon_term_offsets[num_lexicon_records] = lexicon_pool_size;
+    LexiconRecord *record = &lexicon_records[num_lexicon_records++];
+    memset(record, 0, sizeof(LexiconRecord));
+    record->skip_offset = skip_offset;
+    record->num_entries = current_entry->num_entries;
+    if (current_entry->inline_term) {
+        memcpy(record->inline_doc_ids, current_entry->inline_doc_ids,
+               sizeof(int) * current_entry->num_inline);
+        memcpy(record->inline_freqs, current_entry->inline_freqs,
+               sizeof(int) * current_entry->num_inline);
+        record->num_blocks = 0;
+    } else {
+        record->start_d_block = current_entry->start_d_block;
+        record->last_d_block = current_entry->last_d_block;
+        record->start_d_offset = current_entry->start_d_offset;
+        record->start_f_offset = current_entry->start_f_offset;
+        record->last_d_offset = current_entry->last_d_offset;
+        record->last_f_offset = current_entry->last_f_offset;
+        record->num_blocks = current_entry->num_blocks + 1;
     }
+    record->last_did = current_entry->last_did;
+    record->max_score = current_entry->max_score;
+    record->num_containers = current_entry->num_containers;
+    memcpy(lexicon_pool + lexicon_pool_size, current_entry->term, term_length);
+    lexicon_pool_size += term_length;
+}
 
-    // add compressed docid and freq to docids and freqs blocks
-    memcpy(docids->data + docids->size, compressed_doc_data,
-           compressed_doc_size);
-    docids->size += compressed_doc_size;
-    memcpy(freqs->data + freqs->size, compressed_freq_data,
-           compressed_freq_size);
-    freqs->size += compressed_freq_size;
+// 64-bit FNV-1a hash of a term. the bucket and the slot of the minimal
+// perfect hash both come from it, so a lookup hashes the term only once
+uint64_t hash_term(const char *term) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *term; term++) {
+        h ^= (unsigned char)*term;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// slot of a term hash under the seed of its bucket, the splitmix64 finalizer
+// spreads every seed over all n slots
+size_t mph_slot(uint64_t h, unsigned int seed, size_t n) {
+    h += (seed + 1) * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return h % n;
+}
+
+// this function builds a minimal perfect hash over the lexicon terms, CHD
+// style: the terms are split into buckets by hash, and from the largest
+// bucket to the smallest, each bucket gets the first seed that sends all of
+// its terms to free slots. the records are then moved to their slots, and
+// slots gets the slot of every record
+unsigned int *build_perfect_hash(size_t num_buckets, size_t *slots) {
+    size_t n = num_lexicon_records;
+    uint64_t *hashes = malloc(sizeof(uint64_t) * n);
+    size_t *bucket_start = calloc(num_buckets + 1, sizeof(size_t));
+    size_t *bucket_terms = malloc(sizeof(size_t) * n);
+    unsigned char *taken = calloc(n, 1);
+    unsigned int *seeds = calloc(num_buckets, sizeof(unsigned int));
+    if (!hashes || !bucket_start || !bucket_terms || !taken || !seeds) {
+        perror("Error allocating memory for the perfect hash");
+        exit(EXIT_FAILURE);
+    }
+
+    // group the records by bucket, counting sort on the bucket number
+    for (size_t i = 0; i < n; i++) {
+        hashes[i] = hash_term(lexicon_pool + lexicon_term_offsets[i]);
+        bucket_start[hashes[i] % num_buckets + 1]++;
+    }
+    size_t max_bucket = 0;
+    for (size_t b = 0; b < num_buckets; b++) {
+        if (bucket_start[b + 1] > max_bucket) {
+            max_bucket = bucket_start[b + 1];
+        }
+        bucket_start[b + 1] += bucket_start[b];
+    }
+    size_t *fill = malloc(sizeof(size_t) * num_buckets);
+    if (!fill) {
+        perror("Error allocating memory for the perfect hash");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(fill, bucket_start, sizeof(size_t) * num_buckets);
+    for (size_t i = 0; i < n; i++) {
+        bucket_terms[fill[hashes[i] % num_buckets]++] = i;
+    }
+    free(fill);
+
+    // place the buckets from the largest to the smallest, the large ones are
+    // the hardest to fit so they go while most slots are still free
+    size_t *bucket_slots = malloc(sizeof(size_t) * (max_bucket + 1));
+    if (!bucket_slots) {
+        perror("Error allocating memory for the perfect hash");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t size = max_bucket; size > 0; size--) {
+        for (size_t b = 0; b < num_buckets; b++) {
+            size_t start = bucket_start[b];
+            if (bucket_start[b + 1] - start != size) {
+                continue;
+            }
+            unsigned int seed = 0;
+            size_t k = 0;
+            while (k < size) {
+                // try the seed on every term of the bucket, the slots must
+                // be free and different from each other
+                for (k = 0; k < size; k++) {
+                    size_t slot =
+                        mph_slot(hashes[bucket_terms[start + k]], seed, n);
+                    size_t j = 0;
+                    while (j < k && bucket_slots[j] != slot) {
+                        j++;
+                    }
+                    if (taken[slot] || j < k) {
+                        break;
+                    }
+                    bucket_slots[k] = slot;
+                }
+                if (k < size && ++seed == 0) {
+                    fprintf(stderr, "Error building the perfect hash\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            seeds[b] = seed;
+            for (k = 0; k < size; k++) {
+                taken[bucket_slots[k]] = 1;
+                slots[bucket_terms[start + k]] = bucket_slots[k];
+            }
+        }
+    }
+
+    // move every record to its slot
+    LexiconRecord *placed = malloc(sizeof(LexiconRecord) * (n ? n : 1));
+    if (!placed) {
+        perror("Error allocating memory for the perfect hash");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++) {
+        placed[slots[i]] = lexicon_records[i];
+    }
+    free(lexicon_records);
+    lexicon_records = placed;
+
+    free(bucket_slots);
+    free(taken);
+    free(bucket_terms);
+    free(bucket_start);
+    free(hashes);
+    return seeds;
+}
+
+// orders record numbers by their term
+int compare_record_terms(const void *a, const void *b) {
+    return strcmp(lexicon_pool + lexicon_term_offsets[*(const size_t *)a],
+                  lexicon_pool + lexicon_term_offsets[*(const size_t *)b]);
+}
+
+// this function front codes the sorted terms into blocks of DICT_BLOCK_SIZE:
+// the first term of a block is stored whole, the others as one byte with the
+// length of the prefix they share with the previous term, followed by the
+// rest of the term. every string is NUL-terminated. offsets gets the start of
+// each block and size the total size of the blocks. the query processor's
+// front_code, for text lexicons, is a copy of this one and has to match it
+unsigned char *front_code(const char **terms, size_t n, unsigned int *offsets,
+                          size_t *size) {
+    size_t capacity = 1;
+    for (size_t i = 0; i < n; i++) {
+        capacity += strlen(terms[i]) + 2;
+    }
+    unsigned char *dict = malloc(capacity);
+    if (!dict) {
+        perror("Error allocating memory for the term dictionary");
+        exit(EXIT_FAILURE);
+    }
+    size_t pos = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t lcp = 0;
+        if (i % DICT_BLOCK_SIZE == 0) {
+            offsets[i / DICT_BLOCK_SIZE] = pos;
+        } else {
+            while (terms[i][lcp] && terms[i][lcp] == terms[i - 1][lcp]) {
+                lcp++;
+            }
+            dict[pos++] = lcp; // terms are shorter than MAX_WORD_SIZE
+        }
+        size_t length = strlen(terms[i] + lcp) + 1;
+        memcpy(dict + pos, terms[i] + lcp, length);
+        pos += length;
+    }
+    *size = pos;
+    return dict;
+}
+
+// this function pads fskips (the index file or impacts.dat) with zeros to a
+// multiple of 8 bytes
+void align_skips(FILE *fskips) {
+    static const unsigned char zeros[8];
+    size_t pad = (8 - ftell(fskips) % 8) % 8;
+    if (fwrite(zeros, 1, pad, fskips) != pad) {
+        perror("Error writing skip tables");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// appends the offsets of the terms' segment lists to impacts.dat in term_id
+// order, given by order, and fills in its header
+void write_impact_directory(const size_t *order, size_t n) {
+    ImpactsHeader header;
+    memset(&header, 0, sizeof(ImpactsHeader));
+    memcpy(header.magic, IMPACTS_MAGIC, sizeof(header.magic));
+    header.num_terms = n;
+    align_skips(fimpacts);
+    header.directory_offset = ftell(fimpacts);
+    for (size_t i = 0; i < n; i++) {
+        if (fwrite(&impact_offsets[order[i]], sizeof(size_t), 1, fimpacts) !=
+            1) {
+            perror("Error writing impact directory");
+            exit(EXIT_FAILURE);
+        }
+    }
+    rewind(fimpacts);
+    if (fwrite(&header, sizeof(ImpactsHeader), 1, fimpacts) != 1) {
+        perror("Error writing impacts header");
+        exit(EXIT_FAILURE);
+    }
+    fclose(fimpacts);
+    fimpacts = NULL;
+    free(impact_offsets);
+}
+
+// this function builds the perfect hash and the term dictionary, and writes
+// the binary lexicon
+void write_binary_lexicon(const char *filename) {
+    FILE *flexi = fopen(filename, "wb");
+    if (!flexi) {
+        perror("Error opening binary lexicon");
+        exit(EXIT_FAILURE);
+    }
+    size_t n = num_lexicon_records;
+    size_t num_buckets = n / MPH_BUCKET_SIZE + 1;
+    size_t num_dict_blocks = (n + DICT_BLOCK_SIZE - 1) / DICT_BLOCK_SIZE;
+
+    // sort the records by term for the dictionary. the postings come sorted
+    // with sort --version-sort, the lookups need strcmp order
+    size_t *order = malloc(sizeof(size_t) * (n ? n : 1));
+    const char **sorted_terms = malloc(sizeof(char *) * (n ? n : 1));
+    size_t *slots = malloc(sizeof(size_t) * (n ? n : 1));
+    unsigned int *dict_records = malloc(sizeof(unsigned int) * (n ? n : 1));
+    unsigned int *dict_offsets =
+        malloc(sizeof(unsigned int) * (num_dict_blocks ? num_dict_blocks : 1));
+    if (!order || !sorted_terms || !slots || !dict_records || !dict_offsets) {
+        perror("Error allocating memory for the term dictionary");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    qsort(order, n, sizeof(size_t), compare_record_terms);
+    for (size_t i = 0; i < n; i++) {
+        sorted_terms[i] = lexicon_pool + lexicon_term_offsets[order[i]];
+    }
+
+    unsigned int *seeds = build_perfect_hash(num_buckets, slots);
+
+    // link the dictionary and the records both ways
+    for (size_t i = 0; i < n; i++) {
+        dict_records[i] = slots[order[i]];
+        lexicon_records[slots[order[i]]].term_id = i;
+    }
+    if (fimpacts) {
+        write_impact_directory(order, n);
+    }
+    size_t dict_size;
+    unsigned char *dict = front_code(sorted_terms, n, dict_offsets, &dict_size);
+
+    LexiconHeader header;
+    memset(&header, 0, sizeof(LexiconHeader));
+    memcpy(header.magic, LEXICON_MAGIC, sizeof(header.magic));
+    header.version = index_version;
+    header.codec = index_codec;
+    header.num_terms = n;
+    header.num_buckets = num_buckets;
+    header.dict_size = dict_size;
+    header.impact_scale = impact_scale;
+    if (fwrite(&header, sizeof(LexiconHeader), 1, flexi) != 1 ||
+        fwrite(lexicon_records, sizeof(LexiconRecord), n, flexi) != n ||
+        fwrite(seeds, sizeof(unsigned int), num_buckets, flexi) !=
+            num_buckets ||
+        fwrite(dict_records, sizeof(unsigned int), n, flexi) != n ||
+        fwrite(dict_offsets, sizeof(unsigned int), num_dict_blocks, flexi) !=
+            num_dict_blocks ||
+        fwrite(dict, 1, dict_size, flexi) != dict_size) {
+        perror("Error writing binary lexicon");
+        exit(EXIT_FAILURE);
+    }
+    fclose(flexi);
+
+    free(dict);
+    free(seeds);
+    free(dict_offsets);
+    free(dict_records);
+    free(slots);
+    free(sorted_terms);
+    free(order);
+    free(lexicon_records);
+    free(lexicon_term_offsets);
+    free(lexicon_pool);
+}
+
+// this function counts the Roaring containers the docIDs of a bitmap term
+// take
+size_t count_containers(LexiconEntry *current_entry) {
+    size_t n = 0;
+    for (size_t i = 0; i < current_entry->num_doc_ids; i++) {
+        if (i == 0 || current_entry->doc_ids[i] >> 16 !=
+                          current_entry->doc_ids[i - 1] >> 16) {
+            n++;
+        }
+    }
+    return n;
+}
+
+// this function writes the docIDs of a bitmap term to fskips as Roaring
+// containers: the aligned container directory, then the bitmap or array of
+// each container
+void write_containers(FILE *fskips, LexiconEntry *current_entry) {
+    size_t n = current_entry->num_containers;
+    RoaringContainer *containers = calloc(n, sizeof(RoaringContainer));
+    if (!containers) {
+        perror("Error allocating memory for Roaring containers");
+        exit(EXIT_FAILURE);
+    }
+    align_skips(fskips);
+    size_t offset = ftell(fskips) + n * sizeof(RoaringContainer);
+    size_t c = 0;
+    for (size_t i = 0; i < current_entry->num_doc_ids; i++) {
+        int key = current_entry->doc_ids[i] >> 16;
+        if (i > 0 && key != containers[c].key) {
+            c++;
+        }
+        if (containers[c].cardinality == 0) {
+            containers[c].key = key;
+            containers[c].rank = i;
+        }
+        containers[c].cardinality++;
+    }
+    for (c = 0; c < n; c++) {
+        containers[c].offset = offset;
+        size_t size = containers[c].cardinality > ARRAY_CONTAINER_MAX
+                          ? BITMAP_CONTAINER_BYTES
+                          : containers[c].cardinality * sizeof(uint16_t);
+        offset += (size + 7) / 8 * 8;
+    }
+    if (fwrite(containers, sizeof(RoaringContainer), n, fskips) != n) {
+        perror("Error writing Roaring containers");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t bitmap[BITMAP_CONTAINER_BYTES / sizeof(uint64_t)];
+    uint16_t array[ARRAY_CONTAINER_MAX];
+    for (c = 0; c < n; c++) {
+        const int *doc_ids = current_entry->doc_ids + containers[c].rank;
+        size_t count = containers[c].cardinality;
+        const void *data = array;
+        size_t size = count * sizeof(uint16_t);
+        if (count > ARRAY_CONTAINER_MAX) {
+            memset(bitmap, 0, sizeof(bitmap));
+            for (size_t i = 0; i < count; i++) {
+                int low = doc_ids[i] & 0xFFFF;
+                bitmap[low >> 6] |= 1ULL << (low & 63);
+            }
+            data = bitmap;
+            size = sizeof(bitmap);
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                array[i] = doc_ids[i] & 0xFFFF;
+            }
+        }
+        if (fwrite(data, 1, size, fskips) != size) {
+            perror("Error writing Roaring containers");
+            exit(EXIT_FAILURE);
+        }
+        align_skips(fskips);
+    }
+    free(containers);
+}
+
+// orders the sort keys of a term's impact segment postings
+int compare_segment_keys(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// this function writes the impact segments of a term to impacts.dat and
+// remembers where they start for the directory. the postings are sorted by
+// decreasing impact, then by docID, through one key per posting
+void write_impact_segments(LexiconEntry *current_entry) {
+    size_t n = current_entry->num_impacts;
+    uint64_t *keys = malloc(sizeof(uint64_t) * (n ? n : 1));
+    ImpactSegment *segments = malloc(sizeof(ImpactSegment) * (n ? n : 1));
+    unsigned char *data = malloc(n * 5 + 1); // at most 5 bytes per gap
+    if (!keys || !segments || !data) {
+        perror("Error allocating memory for impact segments");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (uint64_t)(65535 - current_entry->impacts[i]) << 32 |
+                  (uint32_t)current_entry->impact_doc_ids[i];
+    }
+    qsort(keys, n, sizeof(uint64_t), compare_segment_keys);
+
+    unsigned int num_segments = 0;
+    size_t size = 0;
+    int prev_doc_id = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned int impact = 65535 - (unsigned int)(keys[i] >> 32);
+        int doc_id = (int)(keys[i] & 0xFFFFFFFF);
+        if (num_segments == 0 || segments[num_segments - 1].impact != impact) {
+            segments[num_segments].impact = impact;
+            segments[num_segments].count = 0;
+            segments[num_segments].size = 0;
+            num_segments++;
+            prev_doc_id = 0;
+        }
+        size_t length = varbyte_encode(doc_id - prev_doc_id, data + size);
+        segments[num_segments - 1].count++;
+        segments[num_segments - 1].size += length;
+        size += length;
+        prev_doc_id = doc_id;
+    }
 
-    // Add the last inserted docID to the last array (updating)
-    current_entry->last[current_entry->num_blocks] = doc_id;
+    impact_offsets[num_lexicon_records - 1] = ftell(fimpacts);
+    if (fwrite(&num_segments, sizeof(unsigned int), 1, fimpacts) != 1 ||
+        fwrite(segments, sizeof(ImpactSegment), num_segments, fimpacts) !=
+            num_segments ||
+        fwrite(data, 1, size, fimpacts) != size) {
+        perror("Error writing impact segments");
+        exit(EXIT_FAILURE);
+    }
+    free(keys);
+    free(segments);
+    free(data);
+}
+
+// this function writes the lexicon entry of a finished term. from version 3
+// on the term's skip table goes to fskips (appended to the index file at the
+// end) and the term gets a binary lexicon record pointing at it. version 4
+// follows the skip table with the sub-block entries of all blocks,
+// ceil(count / SUB_BLOCK_SIZE) per block, and version 5 follows those with the
+// largest score of each sub-block (one float each). the docIDs of a version 6
+// bitmap term come last, as Roaring containers, and a version 7 inline term
+// has nothing there, its postings are in the record. older versions write a
+// text line to lexicon_out that lists the last docID of each block instead.
+// with -s the term's impact segments go to impacts.dat as well
+void write_lexicon_entry(FILE *flexi, FILE *fskips,
+                         LexiconEntry *current_entry) {
+    if (index_version >= INDEX_VERSION_SKIPS) {
+        if (current_entry->doc_ids) {
+            current_entry->num_containers = count_containers(current_entry);
+        }
+        add_lexicon_record(current_entry, ftell(fskips));
+        if (fimpacts) {
+            write_impact_segments(current_entry);
+        }
+        if (fwrite(current_entry->skips, sizeof(SkipEntry),
+                   current_entry->num_skips,
+                   fskips) != current_entry->num_skips) {
+            perror("Error writing skip table");
+            exit(EXIT_FAILURE);
+        }
+        if (index_version >= INDEX_VERSION_SUBSKIPS &&
+            fwrite(current_entry->sub_skips, sizeof(SubSkipEntry),
+                   current_entry->num_sub_skips,
+                   fskips) != current_entry->num_sub_skips) {
+            perror("Error writing sub-block skip table");
+            exit(EXIT_FAILURE);
+        }
+        if (index_version >= INDEX_VERSION_BLOCKMAX &&
+            fwrite(current_entry->sub_max_scores, sizeof(float),
+                   current_entry->num_sub_skips,
+                   fskips) != current_entry->num_sub_skips) {
+            perror("Error writing sub-block scores");
+            exit(EXIT_FAILURE);
+        }
+        if (current_entry->doc_ids) {
+            write_containers(fskips, current_entry);
+        }
+        return;
+    }
+
+    fprintf(flexi, "%s %d %d %zu %zu %d %zu %zu %d %zu", current_entry->term,
+            current_entry->num_entries, current_entry->start_d_block,
+            current_entry->start_d_offset, current_entry->start_f_offset,
+            current_entry->last_d_block, current_entry->last_d_offset,
+            current_entry->last_f_offset, current_entry->last_did,
+            current_entry->num_blocks);
+    for (size_t i = 0; i < current_entry->num_skips; i++) {
+        fprintf(flexi, " %d", current_entry->skips[i].max_did);
+    }
+    fprintf(flexi, "\n");
 }
 
 // this is the main function that opens all of the files, scans in lines from
@@ -191,14 +1540,53 @@ void create_inverted_index(const char *sorted_file_path) {
         exit(EXIT_FAILURE);
     }
 
-    FILE *flexi = fopen("lexicon_out", "wb");
-    if (!flexi) {
-        perror("Error opening lexicon_out");
+    // version 3 and up get the binary lexicon.bin, written at the end, older
+    // versions the text lexicon_out. the other file is removed so the query
+    // processor never picks up a lexicon from an earlier build
+    FILE *flexi = NULL;
+    if (index_version < INDEX_VERSION_SKIPS) {
+        flexi = fopen("lexicon_out", "wb");
+        if (!flexi) {
+            perror("Error opening lexicon_out");
+            exit(EXIT_FAILURE);
+        }
+        remove("lexicon.bin");
+    } else {
+        remove("lexicon_out");
+    }
+
+    // with -s the impact segments go to impacts.dat, its header is written
+    // last. without -s an old impacts.dat is removed so the query processor
+    // never picks up segments from an earlier build
+    if (impact_segments) {
+        fimpacts = fopen("impacts.dat", "wb");
+        ImpactsHeader header;
+        memset(&header, 0, sizeof(ImpactsHeader));
+        if (!fimpacts ||
+            fwrite(&header, sizeof(ImpactsHeader), 1, fimpacts) != 1) {
+            perror("Error opening impacts.dat");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        remove("impacts.dat");
+    }
+
+    // skip tables are collected here while the blocks are written, and
+    // appended to the index file at the end
+    FILE *fskips = tmpfile();
+    if (!fskips) {
+        perror("Error creating temporary skip table file");
         exit(EXIT_FAILURE);
     }
 
     read_words_out("words_out.txt");
 
+    // header line tells the query processor which posting format to expect
+    if (flexi) {
+        fprintf(flexi, "#version %d\n", index_version);
+        fprintf(flexi, "#codec %d\n", index_codec);
+    }
+
     // Allocate memory for blocks array- this will hold all the compressed
     // blocks we can fill before piping to file
     MemoryBlock *blocks = malloc(sizeof(MemoryBlock));
@@ -273,28 +1661,24 @@ void create_inverted_index(const char *sorted_file_path) {
                 insert_posting(docids, freqs, current_posting_did,
                                current_posting_count, &current_block_number,
                                blocks, findex, &current_entry);
+                insert_pack(docids, freqs, &current_block_number, blocks,
+                            findex, &current_entry);
                 current_entry.last_d_offset = docids->size;
                 current_entry.last_f_offset = freqs->size;
                 current_entry.last_d_block = current_block_number;
                 current_entry.last_did = last_doc_id;
 
                 // insert current entry into lexicon
-                fprintf(
-                    flexi, "%s %d %d %zu %zu %d %zu %zu %d %zu",
-                    current_entry.term, current_entry.num_entries,
-                    current_entry.start_d_block, current_entry.start_d_offset,
-                    current_entry.start_f_offset, current_entry.last_d_block,
-                    current_entry.last_d_offset, current_entry.last_f_offset,
-                    current_entry.last_did, current_entry.num_blocks);
-                for (size_t i = 0; i <= current_entry.num_blocks; i++) {
-                    fprintf(flexi, " %d", current_entry.last[i]);
-                }
-                fprintf(flexi, "\n");
+                write_lexicon_entry(flexi, fskips, &current_entry);
 
                 // free current entry's allocated memory
                 free(current_entry.term);
-                free(current_entry
-                         .last); // Free the memory allocated for the last array
+                free(current_entry.skips); // Free the skip tables
+                free(current_entry.sub_skips);
+                free(current_entry.sub_max_scores);
+                free(current_entry.doc_ids);
+                free(current_entry.impact_doc_ids);
+                free(current_entry.impacts);
             }
 
             // update current posting list's term
@@ -325,9 +1709,57 @@ void create_inverted_index(const char *sorted_file_path) {
             }
             current_entry.num_entries = term_entry->count;
 
-            // Initialize the last array and num_blocks
-            current_entry.last = malloc(sizeof(int) * MAX_BLOCKS);
+            // Initialize the skip table and num_blocks, the table grows
+            // with the list so there is no limit on the number of blocks
+            current_entry.skips_capacity = 4;
+            current_entry.skips =
+                malloc(sizeof(SkipEntry) * current_entry.skips_capacity);
+            if (!current_entry.skips) {
+                perror("Error allocating memory for skip table");
+                exit(EXIT_FAILURE);
+            }
+            current_entry.num_skips = 0;
             current_entry.num_blocks = 0;
+            current_entry.sub_skips_capacity = 4;
+            current_entry.sub_skips = malloc(
+                sizeof(SubSkipEntry) * current_entry.sub_skips_capacity);
+            current_entry.sub_max_scores =
+                malloc(sizeof(float) * current_entry.sub_skips_capacity);
+            if (!current_entry.sub_skips || !current_entry.sub_max_scores) {
+                perror("Error allocating memory for sub-block skip table");
+                exit(EXIT_FAILURE);
+            }
+            current_entry.num_sub_skips = 0;
+
+            if (fimpacts) {
+                current_entry.impacts_capacity = current_entry.num_entries + 1;
+                current_entry.impact_doc_ids =
+                    malloc(sizeof(int) * current_entry.impacts_capacity);
+                current_entry.impacts =
+                    malloc(sizeof(int) * current_entry.impacts_capacity);
+                if (!current_entry.impact_doc_ids || !current_entry.impacts) {
+                    perror("Error allocating memory for impact segments");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            // tiny lists go to the lexicon, dense terms keep their docIDs
+            // for the Roaring containers
+            if (index_version >= INDEX_VERSION_INLINE &&
+                current_entry.num_entries <= INLINE_POSTINGS) {
+                current_entry.inline_term = 1;
+            } else if (index_version >= INDEX_VERSION_BITMAP &&
+                       (size_t)current_entry.num_entries * BITMAP_DENSITY >=
+                           doc_id_range) {
+                current_entry.doc_ids_capacity = current_entry.num_entries + 1;
+                current_entry.doc_ids =
+                    malloc(sizeof(int) * current_entry.doc_ids_capacity);
+                if (!current_entry.doc_ids) {
+                    perror("Error allocating memory for docIDs of bitmap "
+                           "term");
+                    exit(EXIT_FAILURE);
+                }
+            }
         }
 
         // not a new term
@@ -351,6 +1783,8 @@ void create_inverted_index(const char *sorted_file_path) {
     // add very last posting to docids and frequencies
     insert_posting(docids, freqs, current_posting_did, current_posting_count,
                    &current_block_number, blocks, findex, &current_entry);
+    insert_pack(docids, freqs, &current_block_number, blocks, findex,
+                &current_entry);
 
     // fill in lexicon values for last term
     if (current_entry.term != NULL && current_entry.term[0] != '\0') {
@@ -358,22 +1792,24 @@ void create_inverted_index(const char *sorted_file_path) {
         current_entry.last_f_offset = freqs->size;
         current_entry.last_d_block = current_block_number;
         current_entry.last_did = last_doc_id;
-        fprintf(flexi, "%s %d %d %zu %zu %d %zu %zu %d %zu", current_entry.term,
-                current_entry.num_entries, current_entry.start_d_block,
-                current_entry.start_d_offset, current_entry.start_f_offset,
-                current_entry.last_d_block, current_entry.last_d_offset,
-                current_entry.last_f_offset, current_entry.last_did,
-                current_entry.num_blocks);
-        for (size_t i = 0; i <= current_entry.num_blocks; i++) {
-            fprintf(flexi, " %d", current_entry.last[i]);
-        }
-        fprintf(flexi, "\n");
+        write_lexicon_entry(flexi, fskips, &current_entry);
         free(current_entry.term);
-        free(current_entry.last);
+        free(current_entry.skips);
+        free(current_entry.sub_skips);
+        free(current_entry.sub_max_scores);
+        free(current_entry.doc_ids);
+        free(current_entry.impact_doc_ids);
+        free(current_entry.impacts);
     }
 
-    // write the last blocks of docids and freqs to the blocks array
-    if (freqs->size > 0 && docids->size > 0) {
+    // write the last blocks of docids and freqs to the blocks array. the
+    // docids block is empty when its terms are all bitmap terms, but their
+    // frequencies are still there
+    if (freqs->size > 0) {
+        // pad the last docids block too, the query processor expects the
+        // frequencies to start at the next BLOCK_SIZE boundary
+        memset(docids->data + docids->size, 0, BLOCK_SIZE - docids->size);
+        docids->size = BLOCK_SIZE;
         add_to_index(docids, &current_block_number, blocks, findex);
         add_to_index(freqs, &current_block_number, blocks, findex);
     }
@@ -381,8 +1817,38 @@ void create_inverted_index(const char *sorted_file_path) {
     // Write remaining blocks array to file
     pipe_to_file(blocks, findex);
 
+    if (index_version >= INDEX_VERSION_SKIPS) {
+        // append the skip tables after the blocks, then the offset where they
+        // start as the last 8 bytes of the file. version 6 starts them at a
+        // multiple of 8 bytes, so the aligned Roaring containers in them are
+        // aligned in a mapped index too
+        if (index_version >= INDEX_VERSION_BITMAP) {
+            align_skips(findex);
+        }
+        size_t skips_start = ftell(findex);
+        rewind(fskips);
+        size_t n;
+        while ((n = fread(blocks->data, 1, INDEX_MEMORY_SIZE, fskips)) > 0) {
+            if (fwrite(blocks->data, 1, n, findex) != n) {
+                perror("Error writing skip tables to file");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (fwrite(&skips_start, sizeof(size_t), 1, findex) != 1) {
+            perror("Error writing skip tables offset to file");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (index_version >= INDEX_VERSION_SKIPS) {
+        write_binary_lexicon("lexicon.bin");
+    }
+
     // close files
-    fclose(flexi);
+    fclose(fskips);
+    if (flexi) {
+        fclose(flexi);
+    }
     fclose(fsorted_posts);
     fclose(findex);
 
@@ -399,13 +1865,86 @@ void create_inverted_index(const char *sorted_file_path) {
 
 int main(int argc, char *argv[]) {
 
+    // optional -v <version> to write an older posting format,
+    // -c <varbyte|bp128|streamvbyte|eliasfano> to pick the block codec,
+    // -i <8|16> to store quantized BM25 impacts instead of frequencies, and
+    // -s to write the impact segments for score-at-a-time queries too
+    while (argc > 2 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-s")) {
+            impact_segments = 1;
+            argv++;
+            argc--;
+            continue;
+        }
+        if (argc == 3) {
+            break; // an option without its value
+        }
+        if (!strcmp(argv[1], "-v")) {
+            index_version = atoi(argv[2]);
+            if (index_version < INDEX_VERSION_RAW ||
+                index_version > INDEX_VERSION_INLINE) {
+                fprintf(stderr, "Unknown index version: %s\n", argv[2]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (!strcmp(argv[1], "-c")) {
+            if (!strcmp(argv[2], "varbyte")) {
+                index_codec = CODEC_VARBYTE;
+            } else if (!strcmp(argv[2], "bp128")) {
+                index_codec = CODEC_BP128;
+            } else if (!strcmp(argv[2], "streamvbyte")) {
+                index_codec = CODEC_STREAMVBYTE;
+            } else if (!strcmp(argv[2], "eliasfano")) {
+                index_codec = CODEC_ELIAS_FANO;
+            } else {
+                fprintf(stderr, "Unknown codec: %s\n", argv[2]);
+                exit(EXIT_FAILURE);
+            }
+        } else if (!strcmp(argv[1], "-i")) {
+            impact_bits = atoi(argv[2]);
+            if (impact_bits != 8 && impact_bits != 16) {
+                fprintf(stderr, "Impacts are 8 or 16 bits, not %s\n", argv[2]);
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            break;
+        }
+        argv += 2;
+        argc -= 2;
+    }
     if (argc != 2) {
-        fprintf(stderr, "Usage: %s <sorted_file_path>\n", argv[0]);
+        fprintf(stderr,
+                "Usage: %s [-v <version>] "
+                "[-c <varbyte|bp128|streamvbyte|eliasfano>] [-i <8|16>] "
+                "[-s] <sorted_file_path>\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (index_codec != CODEC_VARBYTE && index_version < INDEX_VERSION_DGAP) {
+        fprintf(stderr, "Only the varbyte codec supports index version %d\n",
+                index_version);
+        exit(EXIT_FAILURE);
+    }
+    if (index_codec == CODEC_ELIAS_FANO &&
+        index_version < INDEX_VERSION_SUBSKIPS) {
+        // the query processor seeks inside the packs from their sub-block
+        // entries
+        fprintf(stderr, "Elias-Fano needs index version %d or newer\n",
+                INDEX_VERSION_SUBSKIPS);
+        exit(EXIT_FAILURE);
+    }
+    if (impact_segments && !impact_bits) {
+        impact_bits = 8; // segments group postings by quantized impact
+    }
+    if (impact_bits && index_version < INDEX_VERSION_SKIPS) {
+        fprintf(stderr, "Impacts need index version %d or newer\n",
+                INDEX_VERSION_SKIPS);
         exit(EXIT_FAILURE);
     }
     const char *sorted_file_path = argv[1];
 
+    write_doc_table("docs_out.txt", "docs.bin");
     create_inverted_index(sorted_file_path);
+    free(doc_lengths);
 
     return 0;
 }
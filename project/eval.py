@@ -157,6 +157,17 @@ def construct_qrels_run(query_results: Dict[int, List[int]], name: str):
     return ranx.Run(out, name)
 
 
+# fraction of the top k results of run a that are also in the top k of run b,
+# averaged over the queries of a
+def overlap_at_k(a: Dict[int, List[int]], b: Dict[int, List[int]], k: int):
+    overlaps = []
+    for q, ranks in a.items():
+        top = set(ranks[:k])
+        if top:
+            overlaps.append(len(top & set(b.get(q, [])[:k])) / len(top))
+    return sum(overlaps) / len(overlaps) if overlaps else 0.0
+
+
 def load_query_ids(query_file):
     with open(query_file) as f:
         return [line.split()[0] for line in f]
@@ -216,6 +227,9 @@ if __name__ == "__main__":
     bm25_rank_dev = read_results("bm25_rank_dev")
     bm25_rank_one = read_results("bm25_rank_one")
     bm25_rank_two = read_results("bm25_rank_two")
+    bm25_norms_rank_dev = read_results("bm25_norms_rank_dev")
+    bm25_norms_rank_one = read_results("bm25_norms_rank_one")
+    bm25_norms_rank_two = read_results("bm25_norms_rank_two")
 
     # HNSW run for each set of queries
     print("\nBuilding HNSW index...")
@@ -260,16 +274,19 @@ if __name__ == "__main__":
     print("Constructing runs...")
     # DEV
     bm25_dev = construct_qrels_run(bm25_rank_dev, "bm25")
+    bm25_norms_dev = construct_qrels_run(bm25_norms_rank_dev, "bm25_norms")
     hnsw_dev = construct_qrels_run(vector_rank_dev, "hnsw")
     rerank_dev = construct_qrels_run(double_rank_dev, "rerank")
 
     # EVAL ONE
     bm25_one = construct_qrels_run(bm25_rank_one, "bm25")
+    bm25_norms_one = construct_qrels_run(bm25_norms_rank_one, "bm25_norms")
     hnsw_one = construct_qrels_run(vector_rank_one, "hnsw")
     rerank_one = construct_qrels_run(double_rank_one, "rerank")
 
     # EVAL TWO
     bm25_two = construct_qrels_run(bm25_rank_two, "bm25")
+    bm25_norms_two = construct_qrels_run(bm25_norms_rank_two, "bm25_norms")
     hnsw_two = construct_qrels_run(vector_rank_two, "hnsw")
     rerank_two = construct_qrels_run(double_rank_two, "rerank")
 
@@ -281,32 +298,52 @@ if __name__ == "__main__":
     # qrels.dev
     print("Evaluating runs for dev...")
     dev_bm25_results = evaluate(bm25_dev, qrels_dev, 1)
+    dev_bm25_norms_results = evaluate(bm25_norms_dev, qrels_dev, 1)
     dev_hnsw_results = evaluate(hnsw_dev, qrels_dev, 1)
     dev_rerank_results = evaluate(rerank_dev, qrels_dev, 1)
 
     # qrels.eval.one
     print("Evaluating runs for eval one...")
     eval1_bm25_results = evaluate(bm25_one, qrels_eval1, 2)
+    eval1_bm25_norms_results = evaluate(bm25_norms_one, qrels_eval1, 2)
     eval1_hnsw_results = evaluate(hnsw_one, qrels_eval1, 2)
     eval1_rerank_results = evaluate(rerank_one, qrels_eval1, 2)
 
     # qrels.eval.two
     print("Evaluating runs for eval two...")
     eval2_bm25_results = evaluate(bm25_two, qrels_eval2, 2)
+    eval2_bm25_norms_results = evaluate(bm25_norms_two, qrels_eval2, 2)
     eval2_hnsw_results = evaluate(hnsw_two, qrels_eval2, 2)
     eval2_rerank_results = evaluate(rerank_two, qrels_eval2, 2)
 
+    # how much of the exact length BM25 ranking the quantized norms keep
+    print("Comparing 1-byte norms with exact lengths...")
+    norms_agreement = {}
+    for name, exact, quantized in [
+        ("dev", bm25_rank_dev, bm25_norms_rank_dev),
+        ("eval one", bm25_rank_one, bm25_norms_rank_one),
+        ("eval two", bm25_rank_two, bm25_norms_rank_two),
+    ]:
+        for cutoff in [10, 100]:
+            norms_agreement[f"{name} overlap@{cutoff}"] = overlap_at_k(
+                exact, quantized, cutoff
+            )
+
     # Collect all results in a dictionary
     results_dict = {
         "Dev BM25 results": dev_bm25_results,
+        "Dev BM25 1-byte norms results": dev_bm25_norms_results,
         "Dev HNSW results": dev_hnsw_results,
         "Dev rerank results": dev_rerank_results,
         "Eval one BM25 results": eval1_bm25_results,
+        "Eval one BM25 1-byte norms results": eval1_bm25_norms_results,
         "Eval one HNSW results": eval1_hnsw_results,
         "Eval one rerank results": eval1_rerank_results,
         "Eval two BM25 results": eval2_bm25_results,
+        "Eval two BM25 1-byte norms results": eval2_bm25_norms_results,
         "Eval two HNSW results": eval2_hnsw_results,
         "Eval two rerank results": eval2_rerank_results,
+        "BM25 1-byte norms vs exact lengths": norms_agreement,
     }
 
     # Write all results to a single file
@@ -17,4 +17,19 @@ mv query_results bm25_rank_one
 exe/proc -b sorted_queries_two 300
 mv query_results bm25_rank_two
 
+# same runs scored with the 1-byte quantized norms instead of exact lengths
+exe/proc -n -b sorted_queries_dev 300
+mv query_results bm25_norms_rank_dev
+
+exe/proc -n -b sorted_queries_one 300
+mv query_results bm25_norms_rank_one
+
+exe/proc -n -b sorted_queries_two 300
+mv query_results bm25_norms_rank_two
+
+# check that block-max WAND and MaxScore return the exhaustive top 300
+exe/proc -m verify sorted_queries_dev 300
+exe/proc -m verify sorted_queries_one 300
+exe/proc -m verify sorted_queries_two 300
+
 python3 ../project/eval.py
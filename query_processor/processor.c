@@ -1,22 +1,86 @@
-#include "uthash.h" // Include uthash header for hash table
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <math.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h> // SSE2 intrinsics for the BP128 decoder
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h> // SSSE3 byte shuffle for the Stream VByte decoder
+#endif
+#if defined(__AVX2__) || defined(__BMI2__)
+#include <immintrin.h> // AVX2 compares for the in-block docID search, BMI2
+                       // bit deposit for the Elias-Fano select
+#endif
 
 #define MAX_WORD_SIZE (size_t)190
 #define MAX_TERMS 20
 #define BLOCK_SIZE (size_t)65536 // 64KB
-#define MAX_BLOCKS                                                             \
-    1000 // Maximum number of blocks for one term- need to check this
-#define N_DOCUMENTS 8841823 // Number of documents in the collection
+
+// on-disk posting formats, read from the lexicon header. lexicons without a
+// header come from HW2 indexes, which store raw docIDs
+#define INDEX_VERSION_RAW 1  // docIDs stored as raw varbytes
+#define INDEX_VERSION_DGAP 2 // docIDs stored as gaps from the previous posting,
+                             // the first posting of each block is absolute
+#define INDEX_VERSION_SKIPS 3 // d-gaps, plus a binary skip table per term at
+                              // the end of the index file instead of the
+                              // last docIDs in the lexicon
+#define INDEX_VERSION_SUBSKIPS 4 // version 3, plus a skip entry for every
+                                 // SUB_BLOCK_SIZE postings inside a block
+#define INDEX_VERSION_BLOCKMAX 5 // version 4, plus the largest BM25 score of
+                                 // every sub-block and of every term
+#define INDEX_VERSION_BITMAP 6 // version 5, with the docIDs of dense terms
+                               // as Roaring containers instead of in the
+                               // blocks
+#define INDEX_VERSION_INLINE 7 // version 6, with the postings of terms in at
+                               // most INLINE_POSTINGS documents in their
+                               // lexicon records instead of in the blocks
+
+// block codecs, read from the lexicon header
+#define CODEC_VARBYTE 0 // one varbyte per docID (or gap) and per frequency
+#define CODEC_BP128 1   // packs of 128 gaps/frequencies bit-packed in 4
+                        // interleaved lanes, with PForDelta exceptions
+#define CODEC_STREAMVBYTE 2 // packs of 128 gaps/frequencies in Stream VByte:
+                            // 2-bit length codes split from the data bytes
+#define CODEC_ELIAS_FANO 3  // packs of 128 docIDs in Elias-Fano, each pack a
+                            // partition of the list, and frequencies in BP128
+#define PACK_SIZE 128   // number of postings in a full pack
+#define SUB_BLOCK_SIZE PACK_SIZE // postings per intra-block skip entry
+#define MAX_SUB_BLOCK_BYTES 2048 // most bytes the frequencies of a sub-block
+                                 // take, a full pack or 128 varbytes
+#define MAX_BLOCK_POSTINGS (BLOCK_SIZE * 4) // most postings of a term in one
+                                            // block, the generator closes
+                                            // blocks at this count
+#define SEARCH_WINDOW 32 // decoded docIDs left to the SIMD compares once
+                         // the in-block search has narrowed down the range
+#define PROBE_SKEW 8 // c_DAAT probes an Elias-Fano list this many times
+                     // longer than the shortest one instead of decoding it
+#define SCORE_BATCH 1024 // documents c_DAAT collects before scoring them
+#define ACC_BLOCK_SIZE 2048 // docIDs per block of TAAT accumulators
+#define BOUND_SLACK 1e-6 // relative slack on the index's score bounds, which
+                         // are rounded up from BM25 in double: term_score in
+                         // float can come out a few ulps above them
 
 // Define constants for search modes
 #define CONJUNCTIVE 1
 #define DISJUNCTIVE 2
+#define BLOCK_MAX_WAND 3 // disjunctive, skipping documents that cannot make
+                         // the top k (needs a version 5 index)
+#define MAXSCORE 4       // the same with MaxScore
+#define TERM_AT_A_TIME 5 // disjunctive, a postings list at a time into
+                         // dense accumulators (for short queries)
+#define SCORE_AT_A_TIME 6 // disjunctive, impact segments of all terms by
+                          // decreasing impact, within a budget (gen -s)
 
 // define structures for min heap to store top k results
 typedef struct {
@@ -34,36 +98,258 @@ typedef struct {
 typedef struct {
     char term[MAX_WORD_SIZE];
     int curr_doc_id;     // current posting's docid
-    int curr_freq;       // current posting's frequency
+    int curr_freq;       // current posting's frequency, -1 until get_freq
+                         // decodes it (version 4 indexes)
     size_t curr_posting; // pointer to current docid in the list
     size_t curr_block;
+    size_t curr_sub_block; // sub-block decoded into the buffers, for
+                           // version 4 indexes
+    size_t curr_size;      // number of postings in the buffers
+    int freqs_decoded;     // whether the frequency buffer holds the current
+                           // sub-block's frequencies
     int compressed; // 0 or 1, whether the current docid block is compressed
     int *curr_d_block_uncompressed;
     int *curr_f_block_uncompressed;
     int num_entries;
+    unsigned char *d_buffer; // the term's compressed docIDs of fetched_block,
+                             // when blocks are fetched on demand
+    unsigned char *f_buffer; // and its frequencies, unless they are read
+                             // per sub-block
+    size_t fetched_block;    // block in the buffers, SIZE_MAX if none
+    // cursors over Roaring containers (bitmap terms) only find docIDs, the
+    // posting's block, sub-block and position for its frequency are worked
+    // out by get_freq
+    size_t curr_container;     // container of curr_doc_id
+    unsigned char *container_buffer; // fetched_container's bitmap or array,
+                                     // when it is fetched on demand
+    size_t fetched_container;  // container in the buffer, SIZE_MAX if none
+    size_t rank_word;  // bitmap containers: words of curr_container counted
+    int rank_count;    // into rank_count so far, so ranks are incremental.
+                       // array containers: position of the last posting
+                       // located in rank_word
+    const unsigned char *pack; // Elias-Fano pack of the current sub-block
+                               // while nextGEQ searches it in place, NULL
+                               // once it is decoded into the buffer
+    int pack_base;             // docID the pack's values are relative to
 } ListPointer;
 
-// Define the structure for lexicon entries
+// one entry of a term's skip table, for each block its postings span
 typedef struct {
-    char term[MAX_WORD_SIZE];
-    int num_entries;
-    int start_d_block;
-    size_t start_d_offset;
-    size_t start_f_offset;
-    int last_d_block;
-    size_t last_d_offset;
-    size_t last_f_offset;
-    int last_did;
-    int *last;
-    size_t num_blocks; // Number of blocks
-    UT_hash_handle hh; // Hash handle for uthash
-} LexiconEntry;
+    int max_did;     // last docID of the term in the block
+    int count;       // number of postings of the term in the block, 0 if
+                     // unknown (indexes older than version 3)
+    size_t d_offset; // byte offset in final_index.dat of the term's first
+                     // docID in the block
+    size_t f_offset; // byte offset of the term's first frequency in the block
+} SkipEntry;
+
+// intra-block skip entry, one for every SUB_BLOCK_SIZE postings of a term in
+// a block (version 4). the first posting of a sub-block is a gap from the
+// last docID of the previous sub-block, or absolute for the first one in a
+// block
+typedef struct {
+    int max_did;             // last docID in the sub-block
+    unsigned short d_offset; // offset of the sub-block's first docID from the
+                             // block's SkipEntry d_offset
+    unsigned short f_offset; // same for the frequencies
+} SubSkipEntry;
+
+// version 5 follows the sub-block entries of a term with the largest BM25
+// score in each sub-block, one float each. the generator computes them with
+// the length each document's norm stands for and rounds them up, so they
+// bound the scores with and without -n
+
+// version 6 stores the docIDs of a term in at least 1 of every 8 documents
+// as Roaring containers after its block-max scores, and keeps only its
+// frequencies in the blocks. the container directory starts at the next
+// 8-byte boundary, each container holds the docIDs sharing their high 16
+// bits, as a bitmap of 65536 bits or, with at most ARRAY_CONTAINER_MAX of
+// them, as a sorted array of the low 16 bits
+#define ARRAY_CONTAINER_MAX 4096
+#define BITMAP_CONTAINER_WORDS 1024 // 64-bit words of a bitmap container
+
+typedef struct {
+    size_t offset;   // where the container's bitmap or array starts,
+                     // relative to the skip tables section
+    int key;         // high 16 bits of the container's docIDs
+    int cardinality; // number of docIDs in the container
+    int rank;        // number of the term's docIDs in earlier containers
+    int unused;
+} RoaringContainer;
+
+// binary lexicon written by the generator from version 3 on: a
+// LexiconHeader, one LexiconRecord per term, the minimal perfect hash seeds
+// (one unsigned int per bucket), then the front-coded term dictionary: the
+// record slot of every term in sorted order (one unsigned int per term), the
+// offset of every block of DICT_BLOCK_SIZE terms (one unsigned int per block)
+// and the blocks. each record sits in the slot the perfect hash gives its
+// term. the file is mmapped and searched in place
+#define LEXICON_MAGIC "LEXBIN6" // 8 bytes with the terminating NUL
+#define DICT_BLOCK_SIZE 16      // terms per front-coded dictionary block
+#define INLINE_POSTINGS 3 // postings that fit in place of the block offsets
+#define MAX_PREFIX_TERMS 10 // most terms a prefix query term expands to
+
+typedef struct {
+    char magic[8];
+    int version;        // format of final_index.dat
+    int codec;          // codec of final_index.dat
+    size_t num_terms;   // number of records
+    size_t num_buckets; // number of minimal perfect hash seeds
+    size_t dict_size;   // size of the front-coded blocks in bytes
+    double impact_scale; // BM25 score of one quantized impact unit, 0 when
+                         // the index stores frequencies
+} LexiconHeader;
+
+typedef struct {
+    size_t skip_offset;   // where the term's skip table starts, relative to
+                          // the skip tables section of the index file. for
+                          // text lexicons (version 1 and 2) the offset of the
+                          // term's last docIDs in lexicon_last
+    unsigned int term_id; // position of the term in the sorted dictionary
+    int num_entries;          // number of documents containing the term
+    union {
+        struct {
+            int start_d_block; // block number where the first docID resides
+            int last_d_block;  // block number where the last docID resides
+            unsigned int start_d_offset; // offsets within a block,
+            unsigned int start_f_offset; // BLOCK_SIZE fits in 32 bits
+            unsigned int last_d_offset;
+            unsigned int last_f_offset;
+        };
+        struct {
+            // the postings of an inline term (num_blocks is 0), version 7
+            int inline_doc_ids[INLINE_POSTINGS];
+            int inline_freqs[INLINE_POSTINGS];
+        };
+    };
+    int last_did;   // the last docID of the term
+    unsigned int num_blocks; // number of blocks the term's posting list
+                             // spans, 0 for an inline term
+    float max_score; // largest BM25 score of the term in any document, 0
+                     // before version 5
+    unsigned int num_containers; // Roaring containers of the term's docIDs,
+                                 // 0 when they are in the blocks
+} LexiconRecord;
+
+// the lexicon, either pointing into the mmapped lexicon.bin or, for text
+// lexicons, into arrays built by load_lexicon and sorted by term
+LexiconRecord *lexicon_records = NULL;
+size_t num_lexicon_records = 0;
+const unsigned int *lexicon_seeds = NULL; // perfect hash seeds, NULL for text
+                                          // lexicons
+size_t lexicon_num_buckets = 0;
+const unsigned int *lexicon_dict_records = NULL; // record of each term in
+                                                 // sorted order
+const unsigned int *lexicon_dict_offsets = NULL; // start of each dictionary
+                                                 // block
+const unsigned char *lexicon_dict = NULL;        // front-coded blocks
+int *lexicon_last = NULL; // last docID of each block, text lexicons only
+void *lexicon_map = NULL; // mapping of lexicon.bin, NULL for text lexicons
+size_t lexicon_map_size = 0;
+
+// binary doc table written by the generator: a DocTableHeader with the
+// collection statistics BM25 needs, then the length of every docID up to the
+// largest one. the file is mmapped and used in place
+#define DOC_TABLE_MAGIC "DOCBIN1" // 8 bytes with the terminating NUL
 
-// Define the hash table for the lexicon
-LexiconEntry *lexicon_table = NULL;
+typedef struct {
+    char magic[8];
+    size_t num_docs;     // number of documents in the collection
+    size_t table_size;   // number of lengths, the largest docID + 1
+    size_t total_length; // sum of the document lengths
+    double avg_length;   // average document length
+} DocTableHeader;
 
 // Define the array for the docs table
 int *doc_table = NULL;
+size_t doc_table_size = 0; // number of lengths, the largest docID + 1
+
+// quantized norms written by the generator: a NormsHeader, then one byte per
+// docID encoding the document length like Lucene's SmallFloat.intToByte4
+#define NORMS_MAGIC "NRMBIN1" // 8 bytes with the terminating NUL
+#define NORMS_FREE_VALUES 24  // byte values that hold the length as is
+
+typedef struct {
+    char magic[8];
+    size_t table_size; // number of norms, the largest docID + 1
+} NormsHeader;
+
+// collection statistics for BM25, from the doc table
+size_t num_documents = 0;
+double avg_doc_length = 0;
+
+#define BM25_K1 1.2 // free parameter
+#define BM25_B 0.75 // free parameter
+
+// with -n, documents are scored with their 1-byte norm instead of their
+// exact length. norm_factors holds k1 * (1 - b + b * length / avgdl) for the
+// length each of the 256 norms stands for
+int use_norms = 0;
+const unsigned char *norms = NULL;
+size_t norms_size = 0;
+double norm_factors[256];
+
+// the length factor k1 * (1 - b + b * length / avgdl) of every docID (from
+// its norm with -n), so the batch scorer gathers one float per posting
+// instead of recomputing it
+float *doc_factors = NULL;
+
+// indexes built with gen -i store each posting's BM25 score quantized to an
+// integer impact instead of its frequency. a document's score is then the sum
+// of its impacts times impact_scale
+double impact_scale = 0;
+
+// impact segments written by gen -s: an ImpactsHeader, every term's segment
+// list (the number of segments, its ImpactSegments by decreasing impact, then
+// the docIDs of each segment as varbyte gaps from 0) and the offset of each
+// term's list by term_id. the file is mmapped and read in place
+#define IMPACTS_MAGIC "IMPBIN1" // 8 bytes with the terminating NUL
+
+typedef struct {
+    char magic[8];
+    size_t num_terms;        // number of terms in the directory
+    size_t directory_offset; // where the offsets by term_id start
+} ImpactsHeader;
+
+typedef struct {
+    unsigned int impact; // quantized impact of every posting in the segment
+    unsigned int count;  // number of postings
+    unsigned int size;   // bytes of varbyte gaps
+} ImpactSegment;
+
+const unsigned char *impacts_map = NULL;
+size_t impacts_size = 0;
+const size_t *impact_directory = NULL;
+
+// score-at-a-time queries stop after this many postings (-P) or this many
+// seconds (-T, given in microseconds), 0 for no limit
+size_t saat_postings_budget = 0;
+double saat_time_budget = 0;
+
+// from version 4 on, only the docIDs of the query terms are read with their
+// postings lists. the frequencies of a sub-block are read and decoded when
+// one of its postings is scored, so documents rejected by an intersection or
+// by pruning cost no frequency I/O or decoding. 0 reads them with the docIDs
+int lazy_freqs = 1;
+
+// without -M, nothing is read with a postings list but its skip tables: each
+// cursor preads the term's part of a block when it moves into it, so the
+// bytes read by a query scale with the blocks it visits. 0 reads whole lists
+// up front
+int fetch_blocks = 1;
+
+// with -M, final_index.dat is mmapped and the cursors decode straight from
+// its pages instead of from copies of each query term's blocks. -A adds
+// madvise hints: random access for the whole index, and will-need for the
+// blocks of the query terms
+unsigned char *index_map = NULL;
+size_t index_map_size = 0;
+int advise_index = 0;
+
+// posting format of the loaded index
+int index_version = INDEX_VERSION_RAW;
+int index_codec = CODEC_VARBYTE;
+size_t skips_start = 0; // offset of the skip tables in final_index.dat
 
 // structure to keep track of postings list for a term
 typedef struct {
@@ -76,22 +362,115 @@ typedef struct {
     size_t last_d_offset;
     size_t last_f_offset;
     int last_did;
-    int *last;
+    SkipEntry *skips; // skip table, one entry per block
+    SubSkipEntry *sub_skips; // intra-block skip entries, NULL for indexes
+                             // older than version 4
+    size_t *first_sub_skip;  // index of each block's first sub-block entry,
+                             // num_blocks + 1 entries
+    float *sub_max_scores;   // largest score in each sub-block, NULL for
+                             // indexes older than version 5
+    double max_score;        // largest score of the term
     size_t num_blocks;
     unsigned char *compressed_d_list;
-    unsigned char *compressed_f_list;
+    unsigned char *compressed_f_list; // NULL when the frequencies are read
+                                      // per sub-block (lazy_freqs)
+    FILE *index; // where fetched blocks and lazy frequencies are read from
+    RoaringContainer *containers; // container directory of a bitmap term,
+                                  // NULL for the others
+    size_t num_containers;
+    int *block_ranks; // bitmap terms: number of postings before each block
+    const int *inline_doc_ids; // postings of an inline term, in its lexicon
+    const int *inline_freqs;   // record, NULL for the others
+    unsigned int term_id; // position of the term in the sorted dictionary,
+                          // finds its impact segments
 } PostingsList;
 
+// everything a query allocates (its terms, skip tables, cursors, decode and
+// fetch buffers, the heap) comes from one arena and is released at once by
+// arena_reset before the next query. the memory is kept: a query that
+// outgrows the arena chains another chunk, and the next reset merges the
+// chunks into one of the combined size, so a batch settles into no allocator
+// calls at all
+#define ARENA_CHUNK_SIZE ((size_t)4 << 20) // first chunk, 4MB
+#define ARENA_ALIGN 16                     // for the SSE decoders
+
+typedef struct ArenaChunk {
+    unsigned char *data;
+    size_t size;
+    size_t used;
+    struct ArenaChunk *prev; // the chunk filled before this one
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk *chunk; // chunk being filled
+} Arena;
+
+Arena query_arena = {NULL};
+
+// add a chunk of at least size bytes to the arena
+void arena_grow(Arena *arena, size_t size) {
+    ArenaChunk *chunk = malloc(sizeof(ArenaChunk));
+    size_t chunk_size = arena->chunk ? 2 * arena->chunk->size
+                                     : ARENA_CHUNK_SIZE;
+    if (chunk_size < size) {
+        chunk_size = size;
+    }
+    if (!chunk || !(chunk->data = malloc(chunk_size))) {
+        perror("Error allocating memory for query arena");
+        exit(EXIT_FAILURE);
+    }
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    chunk->prev = arena->chunk;
+    arena->chunk = chunk;
+}
+
+// allocate size bytes from the arena, aligned to ARENA_ALIGN. the memory is
+// not zeroed
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (!arena->chunk || arena->chunk->size - arena->chunk->used < size) {
+        arena_grow(arena, size);
+    }
+    void *p = arena->chunk->data + arena->chunk->used;
+    arena->chunk->used += size;
+    return p;
+}
+
+char *arena_strdup(Arena *arena, const char *s) {
+    size_t length = strlen(s) + 1;
+    return memcpy(arena_alloc(arena, length), s, length);
+}
+
+// free the arena's memory, returns how much it had
+size_t arena_free(Arena *arena) {
+    size_t total = 0;
+    while (arena->chunk) {
+        ArenaChunk *prev = arena->chunk->prev;
+        total += arena->chunk->size;
+        free(arena->chunk->data);
+        free(arena->chunk);
+        arena->chunk = prev;
+    }
+    return total;
+}
+
+// release everything allocated from the arena, keeping its memory
+void arena_reset(Arena *arena) {
+    if (arena->chunk && arena->chunk->prev) {
+        arena_grow(arena, arena_free(arena));
+    } else if (arena->chunk) {
+        arena->chunk->used = 0;
+    }
+}
+
 // maintaining heap for top k results
 void init_min_heap(MinHeap *heap, size_t capacity) {
-    heap->nodes = (HeapNode *)malloc(capacity * sizeof(HeapNode));
+    heap->nodes = arena_alloc(&query_arena, capacity * sizeof(HeapNode));
     heap->size = 0;
     heap->capacity = capacity;
 }
 
-// free after use
-void free_min_heap(MinHeap *heap) { free(heap->nodes); }
-
 // swap needed to implement heapify
 void swap(HeapNode *a, HeapNode *b) {
     HeapNode temp = *a;
@@ -173,14 +552,270 @@ void print_top_k(MinHeap *heap) {
     }
 }
 
-// function to retrieve metadata from lexicon
-LexiconEntry *get_metadata(const char *term) {
-    LexiconEntry *entry;
-    HASH_FIND_STR(lexicon_table, term, entry); // Find entry in hash table
-    if (entry == NULL) {
+// reads the front-coded dictionary entry at p into term, which holds the
+// previous term of the block unless the entry is the first of its block.
+// returns the next entry
+const unsigned char *dict_read(const unsigned char *p, char *term,
+                               int first) {
+    size_t lcp = first ? 0 : *p++;
+    size_t length = strlen((const char *)p) + 1;
+    memcpy(term + lcp, p, length);
+    return p + length;
+}
+
+// decodes term number id of the sorted dictionary into term, and returns the
+// entry after it
+const unsigned char *dict_term(size_t id, char *term) {
+    const unsigned char *p =
+        lexicon_dict + lexicon_dict_offsets[id / DICT_BLOCK_SIZE];
+    for (size_t i = 0; i <= id % DICT_BLOCK_SIZE; i++) {
+        p = dict_read(p, term, i == 0);
+    }
+    return p;
+}
+
+// whether term number id of the sorted dictionary is term. the entries of its
+// block up to id are compared with term as they are walked instead of being
+// decoded, keeping only how long a prefix of term the current entry shares,
+// and the walk stops at the first entry that sorts after term, since entry id
+// cannot be term then. a lookup still reads up to DICT_BLOCK_SIZE entries,
+// which is the price of front coding the dictionary
+int dict_matches(size_t id, const char *term) {
+    const unsigned char *p =
+        lexicon_dict + lexicon_dict_offsets[id / DICT_BLOCK_SIZE];
+    size_t matched = 0;
+    for (size_t i = 0; i <= id % DICT_BLOCK_SIZE; i++) {
+        size_t lcp = i == 0 ? 0 : *p++;
+        const unsigned char *suffix = p;
+        p += strlen((const char *)suffix) + 1;
+        if (lcp > matched) {
+            // the entry keeps the previous one's first difference with term,
+            // so it is still before term
+            continue;
+        }
+        size_t k = lcp;
+        while (*suffix && *suffix == (unsigned char)term[k]) {
+            suffix++;
+            k++;
+        }
+        matched = k;
+        if (*suffix == '\0' && term[k] == '\0') {
+            return i == id % DICT_BLOCK_SIZE;
+        }
+        if (*suffix > (unsigned char)term[k]) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// returns the id of the first dictionary term >= term, or the number of
+// terms if there is none. the blocks are binary searched on their first term,
+// which is stored whole, then one block is decoded
+size_t dict_lower_bound(const char *term) {
+    size_t num_blocks =
+        (num_lexicon_records + DICT_BLOCK_SIZE - 1) / DICT_BLOCK_SIZE;
+    size_t lo = 0;
+    size_t hi = num_blocks; // first block whose first term is >= term
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp((const char *)lexicon_dict + lexicon_dict_offsets[mid],
+                   term) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return 0;
+    }
+    // the answer is in the block before, or is the first term of block lo
+    size_t id = (lo - 1) * DICT_BLOCK_SIZE;
+    size_t end = lo * DICT_BLOCK_SIZE < num_lexicon_records
+                     ? lo * DICT_BLOCK_SIZE
+                     : num_lexicon_records;
+    char current[MAX_WORD_SIZE];
+    const unsigned char *p = lexicon_dict + lexicon_dict_offsets[lo - 1];
+    for (; id < end; id++) {
+        p = dict_read(p, current, id % DICT_BLOCK_SIZE == 0);
+        if (strcmp(current, term) >= 0) {
+            break;
+        }
+    }
+    return id;
+}
+
+// 64-bit FNV-1a hash of a term, same as the generator's
+uint64_t hash_term(const char *term) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *term; term++) {
+        h ^= (unsigned char)*term;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// slot of a term hash under the seed of its bucket, same as the generator's
+size_t mph_slot(uint64_t h, unsigned int seed, size_t n) {
+    h += (seed + 1) * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return h % n;
+}
+
+// function to retrieve metadata from lexicon. binary lexicons go through the
+// perfect hash: one seed and one record are read, and comparing with the
+// record's dictionary term tells whether the query term is in the lexicon at
+// all. text lexicons binary search the dictionary
+LexiconRecord *get_metadata(const char *term) {
+    if (num_lexicon_records == 0) {
         return NULL;
     }
-    return entry;
+    if (lexicon_seeds) {
+        uint64_t h = hash_term(term);
+        LexiconRecord *record = &lexicon_records[mph_slot(
+            h, lexicon_seeds[h % lexicon_num_buckets], num_lexicon_records)];
+        return dict_matches(record->term_id, term) ? record : NULL;
+    }
+
+    size_t id = dict_lower_bound(term);
+    if (id == num_lexicon_records || !dict_matches(id, term)) {
+        return NULL;
+    }
+    return &lexicon_records[lexicon_dict_records[id]];
+}
+
+// this function expands a prefix query term into the dictionary terms that
+// start with it, and writes the at most max_terms (<= MAX_PREFIX_TERMS) of
+// them in the most documents to terms, most documents first. the frequent
+// completions are usually the ones a wildcard is meant for, the rare ones
+// are often misspellings. returns the number of terms written. every term
+// of the prefix range is read once, so a short prefix in a large lexicon
+// costs a scan of a large part of the dictionary
+size_t expand_prefix(const char *prefix, char **terms, size_t max_terms) {
+    size_t length = strlen(prefix);
+    size_t n = 0;
+    int num_entries[MAX_PREFIX_TERMS];
+    char term[MAX_WORD_SIZE];
+    const unsigned char *p = NULL;
+    if (max_terms == 0) {
+        return 0;
+    }
+    for (size_t id = dict_lower_bound(prefix); id < num_lexicon_records;
+         id++) {
+        p = p && id % DICT_BLOCK_SIZE ? dict_read(p, term, 0)
+                                      : dict_term(id, term);
+        if (strncmp(term, prefix, length) != 0) {
+            break;
+        }
+        int entries = lexicon_records[lexicon_dict_records[id]].num_entries;
+        if (n == max_terms && entries <= num_entries[n - 1]) {
+            continue;
+        }
+        // insertion into the terms kept so far, the last one drops out when
+        // they are full
+        size_t k = n < max_terms ? n++ : n - 1;
+        while (k > 0 && num_entries[k - 1] < entries) {
+            num_entries[k] = num_entries[k - 1];
+            terms[k] = terms[k - 1];
+            k--;
+        }
+        num_entries[k] = entries;
+        terms[k] = arena_strdup(&query_arena, term);
+    }
+    return n;
+}
+
+// whether the frequencies are read per sub-block when a posting is scored
+int reads_freqs_lazily() {
+    return lazy_freqs && index_version >= INDEX_VERSION_SUBSKIPS;
+}
+
+// reads the compressed docIDs of a term from every block its list spans into
+// one buffer, and the frequencies into another if read_freqs is set. the
+// first block is read from the term's start offset and the last one up to
+// its last offset
+void read_postings_blocks(LexiconRecord *metadata, PostingsList *postings_list,
+                          int read_freqs, FILE *index) {
+    postings_list->compressed_d_list =
+        arena_alloc(&query_arena, BLOCK_SIZE * metadata->num_blocks);
+    postings_list->compressed_f_list =
+        read_freqs
+            ? arena_alloc(&query_arena, BLOCK_SIZE * metadata->num_blocks)
+            : NULL;
+
+    // where we are writing to in the docid and frequency buffers
+    size_t d_offset = 0;
+    size_t f_offset = 0;
+    for (int d = metadata->start_d_block; d <= metadata->last_d_block;
+         d += 2) {
+        int f = d + 1; // frequencies always stored in block after docids
+        int first = d == metadata->start_d_block;
+        int last = d == metadata->last_d_block;
+        size_t d_start = first ? metadata->start_d_offset : 0;
+        size_t f_start = first ? metadata->start_f_offset : 0;
+        size_t d_end = last ? metadata->last_d_offset : BLOCK_SIZE;
+        size_t f_end = last ? metadata->last_f_offset : BLOCK_SIZE;
+
+        fseek(index, d * BLOCK_SIZE + d_start, SEEK_SET);
+        fread(postings_list->compressed_d_list + d_offset, 1, d_end - d_start,
+              index);
+        d_offset += d_end - d_start;
+        if (read_freqs) {
+            fseek(index, f * BLOCK_SIZE + f_start, SEEK_SET);
+            fread(postings_list->compressed_f_list + f_offset, 1,
+                  f_end - f_start, index);
+            f_offset += f_end - f_start;
+        }
+    }
+}
+
+// map final_index.dat for -M
+void map_index(FILE *index) {
+    struct stat st;
+    if (fstat(fileno(index), &st) < 0) {
+        perror("Error reading index size");
+        exit(EXIT_FAILURE);
+    }
+    index_map_size = st.st_size;
+    index_map = mmap(NULL, index_map_size, PROT_READ, MAP_SHARED,
+                     fileno(index), 0);
+    if (index_map == MAP_FAILED) {
+        perror("Error mapping index");
+        exit(EXIT_FAILURE);
+    }
+    if (advise_index) {
+        // terms are read a few blocks at a time, readahead would mostly
+        // bring in blocks of other terms
+        madvise(index_map, index_map_size, MADV_RANDOM);
+    }
+}
+
+// asks the kernel to start reading the mapped blocks of a query term, the
+// docIDs of every block and the frequencies too unless they are read lazily
+void advise_postings_list(PostingsList *postings_list) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    for (size_t b = 0; b < postings_list->num_blocks; b++) {
+        size_t offsets[2] = {postings_list->skips[b].d_offset,
+                             postings_list->skips[b].f_offset};
+        size_t num_ranges = reads_freqs_lazily() ? 1 : 2;
+        for (size_t r = 0; r < num_ranges; r++) {
+            size_t start = offsets[r] - offsets[r] % page_size;
+            size_t end = offsets[r] - offsets[r] % BLOCK_SIZE + BLOCK_SIZE;
+            if (b == postings_list->num_blocks - 1) {
+                end = offsets[r] - offsets[r] % BLOCK_SIZE +
+                      (r == 0 ? postings_list->last_d_offset
+                              : postings_list->last_f_offset);
+            }
+            if (end > index_map_size) {
+                end = index_map_size;
+            }
+            if (end > start) {
+                madvise(index_map + start, end - start, MADV_WILLNEED);
+            }
+        }
+    }
 }
 
 // get compressed postings list from index file for each term in query
@@ -189,90 +824,57 @@ size_t retrieve_postings_lists(char **terms, size_t num_terms,
     size_t valid_terms = 0;
     for (size_t i = 0; i < num_terms; i++) {
         // retrieving postings list for term i
-        LexiconEntry *metadata = get_metadata(terms[i]);
-        if (metadata) {
-            size_t d_start =
-                metadata->start_d_offset; // the start offset to be updated as
-                                          // we move through blocks
-            size_t f_start =
-                metadata->start_f_offset; // same but for frequency blocks
-
-            // allocating memory for compressed data
-            postings_lists[valid_terms].compressed_d_list =
-                malloc(BLOCK_SIZE * metadata->num_blocks);
-            postings_lists[valid_terms].compressed_f_list =
-                malloc(BLOCK_SIZE * metadata->num_blocks);
-            if (!postings_lists[valid_terms].compressed_d_list ||
-                !postings_lists[valid_terms].compressed_f_list) {
-                perror("Error allocating memory for compressed docid list and "
-                       "compressed frequency list");
-                exit(EXIT_FAILURE);
-            }
-
-            // to keep track of where we are writing to in
-            // postings_lists[i].compressed_d_list or
-            // postings_lists[i].compressed_f_list
-            size_t d_offset = 0;
-            size_t f_offset = 0;
-
-            for (int d = metadata->start_d_block; d <= metadata->last_d_block;
-                 d += 2) {
-                // read in the docids and freqs
-                int f =
-                    d + 1; // frequencies always stored in block after docids
-                size_t d_block_offset =
-                    (d * BLOCK_SIZE) + d_start; // actual location to seek to
-                                                // for the start of the docids
-                size_t f_block_offset =
-                    (f * BLOCK_SIZE) + f_start; // actual location to seek to
-                                                // for start of frequencies
-                if (d != metadata->last_d_block) {
-                    // not the last block, read in from the offset to the end of
-                    // the block
-                    fseek(index, d_block_offset,
-                          SEEK_SET); // seek to start of docids in current block
-                    fread((postings_lists[valid_terms].compressed_d_list +
-                           d_offset),
-                          1, (BLOCK_SIZE - d_start),
-                          index); // read in from start offset to end of block
-                    d_offset +=
-                        (BLOCK_SIZE - d_start); // incrementing by size of what
-                                                // we just added in
-                    d_block_offset +=
-                        (BLOCK_SIZE -
-                         d_start); // incrementing seek offset by size of what
-                                   // we just added in. updating where we start
-                                   // reading from in index file
-                    d_start = 0; // reset start offset for next block - this is
-                                 // where we start reading in next block
-
-                    fseek(index, f_block_offset,
-                          SEEK_SET); // seek to start of frequencies in current
-                                     // block
-                    fread((postings_lists[valid_terms].compressed_f_list +
-                           f_offset),
-                          1, (BLOCK_SIZE - f_start),
-                          index); // read in from start offset to end of block
-                    f_offset +=
-                        (BLOCK_SIZE - f_start); // incrementing like above
-                    f_block_offset +=
-                        (BLOCK_SIZE - f_start); // incrementing like above
-                    f_start = 0; // reset start offset for next block
-                } else {
-                    // last or only block- only read in from start offset to
-                    // last offset
-                    fseek(index, d_block_offset, SEEK_SET);
-                    fread((postings_lists[valid_terms].compressed_d_list +
-                           d_offset),
-                          1, (metadata->last_d_offset - d_start), index);
-                    d_offset += (metadata->last_d_offset - d_start);
-
-                    fseek(index, f_block_offset, SEEK_SET);
-                    fread((postings_lists[valid_terms].compressed_f_list +
-                           f_offset),
-                          1, (metadata->last_f_offset - f_start), index);
-                    f_offset += (metadata->last_f_offset - f_start);
-                }
+        LexiconRecord *metadata = get_metadata(terms[i]);
+        if (metadata && metadata->num_blocks == 0) {
+            // an inline term, its postings are served from the lexicon
+            // record without touching the index. a single sub-block ends at
+            // the last docID so the cursors and the block-max search treat
+            // it like any other list
+            PostingsList *postings_list = &postings_lists[valid_terms++];
+            memset(postings_list, 0, sizeof(PostingsList));
+            strcpy(postings_list->term, terms[i]);
+            postings_list->num_entries = metadata->num_entries;
+            postings_list->last_did = metadata->last_did;
+            postings_list->index = index;
+            postings_list->max_score = metadata->max_score;
+            SkipEntry *skip = arena_alloc(&query_arena, sizeof(SkipEntry));
+            memset(skip, 0, sizeof(SkipEntry));
+            skip->max_did = metadata->last_did;
+            skip->count = metadata->num_entries;
+            SubSkipEntry *sub_skip =
+                arena_alloc(&query_arena, sizeof(SubSkipEntry));
+            memset(sub_skip, 0, sizeof(SubSkipEntry));
+            sub_skip->max_did = metadata->last_did;
+            size_t *first_sub_skip =
+                arena_alloc(&query_arena, 2 * sizeof(size_t));
+            first_sub_skip[0] = 0;
+            first_sub_skip[1] = 1;
+            float *sub_max_score = arena_alloc(&query_arena, sizeof(float));
+            *sub_max_score = metadata->max_score;
+            postings_list->skips = skip;
+            postings_list->num_blocks = 1;
+            postings_list->sub_skips = sub_skip;
+            postings_list->first_sub_skip = first_sub_skip;
+            postings_list->sub_max_scores = sub_max_score;
+            postings_list->inline_doc_ids = metadata->inline_doc_ids;
+            postings_list->inline_freqs = metadata->inline_freqs;
+            postings_list->term_id = metadata->term_id;
+        } else if (metadata) {
+            postings_lists[valid_terms].inline_doc_ids = NULL;
+            postings_lists[valid_terms].inline_freqs = NULL;
+            postings_lists[valid_terms].term_id = metadata->term_id;
+            if (index_map) {
+                // the cursors decode straight from the mapped pages, block b
+                // of the term starts at its skip entry's offsets
+                postings_lists[valid_terms].compressed_d_list = index_map;
+                postings_lists[valid_terms].compressed_f_list = index_map;
+            } else if (fetch_blocks) {
+                // the cursors fetch the blocks as they get to them
+                postings_lists[valid_terms].compressed_d_list = NULL;
+                postings_lists[valid_terms].compressed_f_list = NULL;
+            } else {
+                read_postings_blocks(metadata, &postings_lists[valid_terms],
+                                     !reads_freqs_lazily(), index);
             }
 
             // Store the postings list and metadata
@@ -287,18 +889,108 @@ size_t retrieve_postings_lists(char **terms, size_t num_terms,
             postings_lists[valid_terms].last_d_offset = metadata->last_d_offset;
             postings_lists[valid_terms].last_f_offset = metadata->last_f_offset;
             postings_lists[valid_terms].last_did = metadata->last_did;
+            postings_lists[valid_terms].index = index;
 
-            // Copy the last array
-            postings_lists[valid_terms].last =
-                malloc(sizeof(int) * metadata->num_blocks);
-            if (!postings_lists[valid_terms].last) {
-                perror("Error allocating memory for last array");
-                exit(EXIT_FAILURE);
+            // read the skip table from the index, older indexes only have
+            // the last docIDs in the lexicon so fill in the rest from the
+            // block layout
+            SkipEntry *skips = arena_alloc(
+                &query_arena, sizeof(SkipEntry) * metadata->num_blocks);
+            if (index_version >= INDEX_VERSION_SKIPS) {
+                fseek(index, skips_start + metadata->skip_offset, SEEK_SET);
+                if (fread(skips, sizeof(SkipEntry), metadata->num_blocks,
+                          index) != metadata->num_blocks) {
+                    perror("Error reading skip table");
+                    exit(EXIT_FAILURE);
+                }
+            } else {
+                for (size_t b = 0; b < metadata->num_blocks; b++) {
+                    skips[b].max_did =
+                        lexicon_last[metadata->skip_offset + b];
+                    skips[b].count = 0;
+                    skips[b].d_offset =
+                        (metadata->start_d_block + 2 * b) * BLOCK_SIZE +
+                        (b == 0 ? metadata->start_d_offset : 0);
+                    skips[b].f_offset =
+                        (metadata->start_d_block + 2 * b + 1) * BLOCK_SIZE +
+                        (b == 0 ? metadata->start_f_offset : 0);
+                }
             }
-            memcpy(postings_lists[valid_terms].last, metadata->last,
-                   sizeof(int) * metadata->num_blocks);
+            postings_lists[valid_terms].skips = skips;
             postings_lists[valid_terms].num_blocks = metadata->num_blocks;
 
+            // the sub-block entries follow the skip table, there are
+            // ceil(count / SUB_BLOCK_SIZE) of them for each block
+            postings_lists[valid_terms].sub_skips = NULL;
+            postings_lists[valid_terms].first_sub_skip = NULL;
+            postings_lists[valid_terms].sub_max_scores = NULL;
+            postings_lists[valid_terms].max_score = metadata->max_score;
+            if (index_version >= INDEX_VERSION_SUBSKIPS) {
+                size_t *first_sub_skip = arena_alloc(
+                    &query_arena, sizeof(size_t) * (metadata->num_blocks + 1));
+                first_sub_skip[0] = 0;
+                for (size_t b = 0; b < metadata->num_blocks; b++) {
+                    first_sub_skip[b + 1] =
+                        first_sub_skip[b] +
+                        (skips[b].count + SUB_BLOCK_SIZE - 1) / SUB_BLOCK_SIZE;
+                }
+                size_t num_sub_skips = first_sub_skip[metadata->num_blocks];
+                SubSkipEntry *sub_skips = arena_alloc(
+                    &query_arena, sizeof(SubSkipEntry) * num_sub_skips);
+                if (fread(sub_skips, sizeof(SubSkipEntry), num_sub_skips,
+                          index) != num_sub_skips) {
+                    perror("Error reading sub-block skip table");
+                    exit(EXIT_FAILURE);
+                }
+                postings_lists[valid_terms].sub_skips = sub_skips;
+                postings_lists[valid_terms].first_sub_skip = first_sub_skip;
+
+                // then the largest score of each sub-block
+                if (index_version >= INDEX_VERSION_BLOCKMAX) {
+                    float *sub_max_scores = arena_alloc(
+                        &query_arena, sizeof(float) * num_sub_skips);
+                    if (fread(sub_max_scores, sizeof(float), num_sub_skips,
+                              index) != num_sub_skips) {
+                        perror("Error reading sub-block scores");
+                        exit(EXIT_FAILURE);
+                    }
+                    postings_lists[valid_terms].sub_max_scores =
+                        sub_max_scores;
+                }
+            }
+
+            // and the Roaring container directory of a bitmap term, the
+            // containers themselves are read when a cursor gets to them
+            postings_lists[valid_terms].containers = NULL;
+            postings_lists[valid_terms].num_containers =
+                metadata->num_containers;
+            postings_lists[valid_terms].block_ranks = NULL;
+            if (metadata->num_containers) {
+                size_t position = ftell(index) - skips_start;
+                fseek(index, (8 - position % 8) % 8, SEEK_CUR);
+                RoaringContainer *containers =
+                    arena_alloc(&query_arena, sizeof(RoaringContainer) *
+                                                  metadata->num_containers);
+                if (fread(containers, sizeof(RoaringContainer),
+                          metadata->num_containers,
+                          index) != metadata->num_containers) {
+                    perror("Error reading Roaring containers");
+                    exit(EXIT_FAILURE);
+                }
+                int *block_ranks = arena_alloc(
+                    &query_arena, sizeof(int) * (metadata->num_blocks + 1));
+                block_ranks[0] = 0;
+                for (size_t b = 0; b < metadata->num_blocks; b++) {
+                    block_ranks[b + 1] = block_ranks[b] + skips[b].count;
+                }
+                postings_lists[valid_terms].containers = containers;
+                postings_lists[valid_terms].block_ranks = block_ranks;
+            }
+
+            if (index_map && advise_index) {
+                advise_postings_list(&postings_lists[valid_terms]);
+            }
+
             valid_terms++;
 
         } else {
@@ -308,35 +1000,39 @@ size_t retrieve_postings_lists(char **terms, size_t num_terms,
     return valid_terms;
 }
 
-// create a list pointer for a postings list
+// create a list pointer for a postings list, it lives until the query arena
+// is reset
 ListPointer *open_list(PostingsList *postings_list) {
-    ListPointer *lp = (ListPointer *)calloc(1, sizeof(ListPointer));
-    if (!lp) {
-        perror("Error allocating memory for list pointer");
-        exit(EXIT_FAILURE);
-    }
+    ListPointer *lp = arena_alloc(&query_arena, sizeof(ListPointer));
+    memset(lp, 0, sizeof(ListPointer));
 
     strcpy(lp->term, postings_list->term);
     lp->curr_doc_id = -1;
     lp->curr_freq = -1;
     lp->curr_posting = 0;
     lp->curr_block = 0;
+    lp->curr_sub_block = 0;
+    lp->curr_size = 0;
     lp->compressed = 1;
     lp->curr_d_block_uncompressed = NULL;
     lp->curr_f_block_uncompressed = NULL;
     lp->num_entries = postings_list->num_entries;
-    return lp;
-}
-
-// close a list pointer
-void close_list(ListPointer *lp) {
-    if (lp->curr_d_block_uncompressed) {
-        free(lp->curr_d_block_uncompressed);
-    }
-    if (lp->curr_f_block_uncompressed) {
-        free(lp->curr_f_block_uncompressed);
+    lp->fetched_block = SIZE_MAX;
+    lp->fetched_container = SIZE_MAX;
+    if (postings_list->inline_doc_ids) {
+        // the whole list is its one sub-block, already decoded
+        size_t size = postings_list->num_entries * sizeof(int);
+        lp->curr_d_block_uncompressed = arena_alloc(&query_arena, size);
+        lp->curr_f_block_uncompressed = arena_alloc(&query_arena, size);
+        memcpy(lp->curr_d_block_uncompressed, postings_list->inline_doc_ids,
+               size);
+        memcpy(lp->curr_f_block_uncompressed, postings_list->inline_freqs,
+               size);
+        lp->curr_size = postings_list->num_entries;
+        lp->compressed = 0;
+        lp->freqs_decoded = 1;
     }
-    free(lp);
+    return lp;
 }
 
 // Comparison function to compare the sizes of the compressed docIDs lists - to
@@ -347,6 +1043,9 @@ int compare_postings_lists(const void *a, const void *b) {
     return (list_a->num_entries - list_b->num_entries);
 }
 
+// checked decoder for a single varbyte, kept for callers outside the block
+// decoding loops. the loops use varbyte_read and varbyte_decode_run, which
+// leave the checks to the caller
 size_t varbyte_decode(unsigned char *input, int *output) {
     if (input == NULL) {
         fprintf(stderr, "Error: input is NULL\n");
@@ -378,10 +1077,99 @@ size_t varbyte_decode(unsigned char *input, int *output) {
     return i + 1; // Return the number of bytes read
 }
 
+// unchecked varbyte decode for the hot loops, most docID gaps and almost all
+// frequencies take one byte so that case is tested first
+static inline size_t varbyte_read(const unsigned char *input, int *output) {
+    if (input[0] < 128) {
+        *output = input[0];
+        return 1;
+    }
+    unsigned int value = input[0] & 0x7F;
+    size_t i = 1;
+    int shift = 7;
+    while (input[i] & 0x80) {
+        value |= (unsigned int)(input[i++] & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= (unsigned int)input[i++] << shift;
+    *output = (int)value;
+    return i;
+}
+
+// decodes n varbytes into output and returns the number of bytes read
+size_t varbyte_decode_run(const unsigned char *input, int *output, size_t n) {
+    const unsigned char *start = input;
+    for (size_t j = 0; j < n; j++) {
+        input += varbyte_read(input, output + j);
+    }
+    return input - start;
+}
+
+// lookup tables for the Stream VByte decoder, indexed by control byte
+unsigned char svb_lengths[256]; // number of data bytes used by the 4 values
+#ifdef __SSSE3__
+__m128i svb_shuffles[256]; // moves the data bytes of 4 values into 4 ints
+#endif
+
+// this function fills the Stream VByte lookup tables
+void init_streamvbyte_tables() {
+    for (int c = 0; c < 256; c++) {
+        unsigned char shuffle[16];
+        int length = 0;
+        for (int k = 0; k < 4; k++) {
+            int value_length = ((c >> (2 * k)) & 3) + 1;
+            for (int b = 0; b < 4; b++) {
+                // 0x80 makes the shuffle write a zero byte
+                shuffle[4 * k + b] = b < value_length ? length + b : 0x80;
+            }
+            length += value_length;
+        }
+        svb_lengths[c] = (unsigned char)length;
+#ifdef __SSSE3__
+        svb_shuffles[c] = _mm_loadu_si128((__m128i *)shuffle);
+#endif
+    }
+}
+
+// this function decodes one Stream VByte pack (see streamvbyte_encode in the
+// generator) into output. returns the number of bytes read and sets count to
+// the number of values decoded
+size_t streamvbyte_decode(const unsigned char *input, int *output,
+                          size_t *count) {
+    size_t n = input[0];
+    *count = n;
+    const unsigned char *control = input + 1;
+    const unsigned char *data = control + (n + 3) / 4;
+    size_t groups = n / 4;
+    size_t g = 0;
+#ifdef __SSSE3__
+    // every group has at least 4 data bytes, so while 4 more full groups
+    // follow a 16 byte load can't run past the end of the pack
+    for (; g + 4 <= groups; g++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)data);
+        v = _mm_shuffle_epi8(v, svb_shuffles[control[g]]);
+        _mm_storeu_si128((__m128i *)(output + 4 * g), v);
+        data += svb_lengths[control[g]];
+    }
+#endif
+    for (size_t j = 4 * g; j < n; j++) {
+        int length = ((control[j / 4] >> (2 * (j % 4))) & 3) + 1;
+        unsigned int value = 0;
+        for (int b = 0; b < length; b++) {
+            value |= (unsigned int)data[b] << (8 * b);
+        }
+        output[j] = (int)value;
+        data += length;
+    }
+    return data - input;
+}
+
 // get the offset for the current docid block
 size_t get_d_block_offset(ListPointer *lp, PostingsList *postings_list) {
     size_t offset;
-    if (lp->curr_block == 0) {
+    if (index_map) {
+        offset = postings_list->skips[lp->curr_block].d_offset;
+    } else if (lp->curr_block == 0) {
         offset = 0;
     } else {
         size_t block_0_size = BLOCK_SIZE - postings_list->start_d_offset;
@@ -393,7 +1181,9 @@ size_t get_d_block_offset(ListPointer *lp, PostingsList *postings_list) {
 // get the offset for the current frequency block
 size_t get_f_block_offset(ListPointer *lp, PostingsList *postings_list) {
     size_t offset;
-    if (lp->curr_block == 0) {
+    if (index_map) {
+        offset = postings_list->skips[lp->curr_block].f_offset;
+    } else if (lp->curr_block == 0) {
         offset = 0;
     } else {
         size_t block_0_size = BLOCK_SIZE - postings_list->start_f_offset;
@@ -402,172 +1192,1251 @@ size_t get_f_block_offset(ListPointer *lp, PostingsList *postings_list) {
     return offset;
 }
 
-// function to decompress current docid and frequency block
-void decompress_block(ListPointer *lp, PostingsList *postings_list) {
-
-    // decompress and write into uncompressed docid block in lp
-    size_t offset = get_d_block_offset(lp, postings_list);
-    size_t i = 0;
-    int last_doc_id_in_block = postings_list->last[lp->curr_block];
-    while (1) {
-        size_t bytes_read =
-            varbyte_decode(postings_list->compressed_d_list + offset,
-                           lp->curr_d_block_uncompressed + i);
-        if (bytes_read == 0) {
-            fprintf(stderr,
-                    "Error in docid decomp: Failed to decode varbyte at offset "
-                    "%zu for term: %s\n",
-                    offset, lp->term);
-            return;
-        }
-        offset += bytes_read;
-        if (lp->curr_d_block_uncompressed[i] == last_doc_id_in_block) {
-            i++;
-            break;
-        }
-        i++;
+// reads size bytes at offset of the index file into buffer
+void read_index(PostingsList *postings_list, unsigned char *buffer,
+                size_t size, size_t offset) {
+    if (pread(fileno(postings_list->index), buffer, size, offset) !=
+        (ssize_t)size) {
+        perror("Error reading postings from index");
+        exit(EXIT_FAILURE);
     }
+}
 
-    // decompress and write into uncompressed frequency block in lp
-    offset = get_f_block_offset(lp, postings_list);
-    size_t j = 0;
-    while (1) {
-        size_t bytes_read =
-            varbyte_decode(postings_list->compressed_f_list + offset,
-                           lp->curr_f_block_uncompressed + j);
-        if (bytes_read == 0) {
-            fprintf(stderr,
-                    "Error in frequency decomp: Failed to decode varbyte at "
-                    "offset %zu for term: %s. j = %zu, i = %zu\n",
-                    offset, lp->term, j, i);
-            return;
-        }
-        offset += bytes_read;
-        j++;
-        if (j == i) {
-            // need to stop after decoding the number of docids decoded,
-            // because we pad the frequencies block with 0s!!
-            // j++;
-            break;
-        }
+// fetches the term's part of the cursor's current block into its buffers,
+// unless it is there already. the frequencies come along only when they are
+// not read per sub-block
+void fetch_block(ListPointer *lp, PostingsList *postings_list) {
+    if (lp->fetched_block == lp->curr_block) {
+        return;
+    }
+    if (!lp->d_buffer) {
+        lp->d_buffer = arena_alloc(&query_arena, BLOCK_SIZE);
+        lp->f_buffer = reads_freqs_lazily()
+                           ? NULL
+                           : arena_alloc(&query_arena, BLOCK_SIZE);
     }
+    SkipEntry *skip = &postings_list->skips[lp->curr_block];
+    int last = lp->curr_block == postings_list->num_blocks - 1;
+    size_t start = skip->d_offset % BLOCK_SIZE;
+    size_t end = last ? postings_list->last_d_offset : BLOCK_SIZE;
+    read_index(postings_list, lp->d_buffer, end - start, skip->d_offset);
+    if (lp->f_buffer) {
+        start = skip->f_offset % BLOCK_SIZE;
+        end = last ? postings_list->last_f_offset : BLOCK_SIZE;
+        read_index(postings_list, lp->f_buffer, end - start, skip->f_offset);
+    }
+    lp->fetched_block = lp->curr_block;
 }
 
-// function to get the next greatest or equal docID from a list
-int nextGEQ(ListPointer *lp, int k, PostingsList *postings_list) {
-    // // implement block by block nextGEQ using [last] array
-    while (postings_list->last[lp->curr_block] < k) {
-        lp->curr_block++;
-        lp->compressed = 1;   // moving to new block, use this info to indicate
-                              // that we should free the old uncompressed data
-        lp->curr_posting = 0; // reset posting index to 0 for new block
-        if (lp->curr_block >= postings_list->num_blocks) {
-            // all of the docids in this list are less than k, terminate search
-            // we have either hit the end of the list or there are no results to
-            // be found
-            lp->curr_doc_id = postings_list->last_did;
-            return lp->curr_doc_id;
-        }
+// the term's compressed docIDs in the cursor's current block, from the
+// mapped index, the list read up front, or fetched into the cursor's buffer
+const unsigned char *d_block_data(ListPointer *lp,
+                                  PostingsList *postings_list) {
+    if (!postings_list->compressed_d_list) {
+        fetch_block(lp, postings_list);
+        return lp->d_buffer;
     }
+    return postings_list->compressed_d_list +
+           get_d_block_offset(lp, postings_list);
+}
 
-    // at this point, lp->curr_block IS the block that contains the next
-    // greatest or equal docID
+// same for the frequencies
+const unsigned char *f_block_data(ListPointer *lp,
+                                  PostingsList *postings_list) {
+    if (!postings_list->compressed_f_list) {
+        fetch_block(lp, postings_list);
+        return lp->f_buffer;
+    }
+    return postings_list->compressed_f_list +
+           get_f_block_offset(lp, postings_list);
+}
 
-    if (lp->compressed) {
-        // free the old uncompressed data if it exists, make room for new block
-        // to be uncompressed
-        if (lp->curr_d_block_uncompressed) {
-            free(lp->curr_d_block_uncompressed);
-            lp->curr_d_block_uncompressed = NULL;
-        }
-        if (lp->curr_f_block_uncompressed) {
-            free(lp->curr_f_block_uncompressed);
-            lp->curr_f_block_uncompressed = NULL;
-        }
-
-        size_t max_uncompressed_size =
-            BLOCK_SIZE *
-            4; // allotting for extra space for uncompressed block of docids
-        lp->curr_d_block_uncompressed =
-            calloc(max_uncompressed_size, sizeof(int));
-        lp->curr_f_block_uncompressed =
-            calloc(max_uncompressed_size, sizeof(int));
-        if (!lp->curr_d_block_uncompressed || !lp->curr_f_block_uncompressed) {
-            perror("Error allocating memory for uncompressed blocks");
-            exit(EXIT_FAILURE);
+// this function unpacks the 128 b-bit values of a full BP128 pack. the
+// generator interleaves the values over 4 32-bit lanes, so with SSE2 every
+// shift/mask step produces 4 values at once
+void bp128_unpack(const unsigned char *input, int b, int *output) {
+    if (b == 0) {
+        memset(output, 0, PACK_SIZE * sizeof(int));
+        return;
+    }
+#ifdef __SSE2__
+    const __m128i *in = (const __m128i *)input;
+    __m128i *out = (__m128i *)output;
+    const __m128i mask =
+        _mm_set1_epi32(b == 32 ? -1 : (int)((1u << b) - 1));
+    __m128i word = _mm_loadu_si128(in);
+    int shift = 0;
+    for (int r = 0; r < PACK_SIZE / 4; r++) {
+        __m128i v = _mm_srl_epi32(word, _mm_cvtsi32_si128(shift));
+        shift += b;
+        if (shift >= 32) {
+            // value (or the next one) continues in the next word of each lane
+            shift -= 32;
+            if (r + 1 < PACK_SIZE / 4 || shift > 0) {
+                word = _mm_loadu_si128(++in);
+            }
+            if (shift > 0) {
+                v = _mm_or_si128(
+                    v, _mm_sll_epi32(word, _mm_cvtsi32_si128(b - shift)));
+            }
         }
-        decompress_block(lp, postings_list);
-        lp->compressed = 0;
+        _mm_storeu_si128(out + r, _mm_and_si128(v, mask));
     }
-
-    // loop through current decompressed block to find next greatest or equal
-    // docID
-    int last_doc_id_in_block = postings_list->last[lp->curr_block];
-    while (1) {
-        if (lp->curr_d_block_uncompressed[lp->curr_posting] >= k) {
-            lp->curr_doc_id = lp->curr_d_block_uncompressed[lp->curr_posting];
-            lp->curr_freq = lp->curr_f_block_uncompressed[lp->curr_posting];
-            return lp->curr_doc_id;
+#else
+    const unsigned int *words = (const unsigned int *)input;
+    unsigned int mask = b == 32 ? 0xFFFFFFFF : (1u << b) - 1;
+    for (int lane = 0; lane < 4; lane++) {
+        int bit = 0;
+        for (int r = 0; r < PACK_SIZE / 4; r++) {
+            int word = bit / 32;
+            int shift = bit % 32;
+            unsigned int v = words[4 * word + lane] >> shift;
+            if (shift + b > 32) {
+                v |= words[4 * (word + 1) + lane] << (32 - shift);
+            }
+            output[4 * r + lane] = (int)(v & mask);
+            bit += b;
         }
-        lp->curr_posting++;
     }
-
-    // if we reach here, something has gone wrong
-    return -1;
+#endif
 }
 
-// this function loads the document lengths from a file into memory
-void load_doc_lengths(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Error opening document lengths file");
-        exit(EXIT_FAILURE);
+// this function decodes one BP128 pack (see bp128_encode in the generator)
+// into output. returns the number of bytes read and sets count to the number
+// of values decoded
+size_t bp128_decode(const unsigned char *input, int *output, size_t *count) {
+    size_t i = 0;
+    size_t n = input[i++];
+    *count = n;
+    if (n < PACK_SIZE) {
+        // partial pack at the end of a posting list, plain varbytes
+        return i + varbyte_decode_run(input + i, output, n);
     }
 
-    doc_table = (int *)malloc(N_DOCUMENTS * sizeof(int));
+    int b = input[i++];
+    int num_exceptions = input[i++];
+    bp128_unpack(input + i, b, output);
+    i += 16 * b;
 
-    int doc_id;
-    int doc_length;
-    while (fscanf(file, "%d %d", &doc_id, &doc_length) == 2) {
-        doc_table[doc_id] = doc_length;
+    // patch in the high bits of the exceptions
+    const unsigned char *positions = input + i;
+    i += num_exceptions;
+    for (int e = 0; e < num_exceptions; e++) {
+        int high;
+        i += varbyte_read(input + i, &high);
+        output[positions[e]] |= (int)((unsigned int)high << b);
     }
-
-    fclose(file);
+    return i;
 }
 
-// function to calculate BM25 score of a single word in a document
-double get_score(int freq, int doc_id, int num_entries) {
-    double k1 = 1.2;               // free parameter
-    double b = 0.75;               // free parameter
-    double avg_doc_length = 66.93; // average document length
-    int d = doc_table[doc_id];     // length of this document
-
-    double score;
-    int f = freq; // term frequency in this document
-    double tf = 0.0;
-    double numerator = f * (k1 + 1.0);
-    double denominator = f + k1 * (1.0 - b + b * (d / avg_doc_length));
-    tf = numerator / denominator;
-    double idf;
-    denominator = num_entries + 0.5;
-    numerator = N_DOCUMENTS - num_entries + 0.5;
-    idf = log((numerator / denominator) + 1.0);
-    score = (idf * tf);
+// this function turns n docID gaps into docIDs, starting from prev_doc_id,
+// and returns the last docID
+int prefix_sum(int *values, size_t n, int prev_doc_id) {
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i prev = _mm_set1_epi32(prev_doc_id);
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((__m128i *)(values + i));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, prev);
+        _mm_storeu_si128((__m128i *)(values + i), v);
+        prev = _mm_shuffle_epi32(v, 0xFF); // broadcast the last docID
+    }
+    prev_doc_id = _mm_cvtsi128_si32(prev);
+#endif
+    for (; i < n; i++) {
+        values[i] += prev_doc_id;
+        prev_doc_id = values[i];
+    }
+    return prev_doc_id;
+}
 
-    return score;
+// decodes one pack with the codec of the loaded index, the frequencies of an
+// Elias-Fano index are BP128 packs
+size_t decode_pack(const unsigned char *input, int *output, size_t *count) {
+    if (index_codec == CODEC_STREAMVBYTE) {
+        return streamvbyte_decode(input, output, count);
+    }
+    return bp128_decode(input, output, count);
+}
+
+// the l low bits of value i of an Elias-Fano pack. the 8-byte load never
+// runs past the pack, the upper bits follow the low ones
+static inline unsigned int elias_fano_low(const unsigned char *low, size_t i,
+                                          int l) {
+    if (l == 0) {
+        return 0;
+    }
+    size_t bit = i * l;
+    uint64_t word;
+    memcpy(&word, low + bit / 8, sizeof(word));
+    return (unsigned int)(word >> (bit % 8)) & ((1u << l) - 1);
+}
+
+// this function decodes an Elias-Fano pack (see elias_fano_encode in the
+// generator) into docIDs, the values plus base. returns the number of bytes
+// read and sets count to the number of docIDs decoded
+size_t elias_fano_decode(const unsigned char *input, int *output,
+                         size_t *count, int base) {
+    size_t n = input[0];
+    int l = input[1];
+    size_t num_words = input[2];
+    const unsigned char *low = input + 3;
+    const unsigned char *upper = low + (n * l + 7) / 8;
+    size_t i = 0;
+    for (size_t w = 0; w < num_words; w++) {
+        uint64_t word;
+        memcpy(&word, upper + 8 * w, sizeof(word));
+        while (word) {
+            size_t high = w * 64 + __builtin_ctzll(word) - i;
+            output[i] = base + (int)((high << l) | elias_fano_low(low, i, l));
+            i++;
+            word &= word - 1;
+        }
+    }
+    *count = n;
+    return 3 + (n * l + 7) / 8 + 8 * num_words;
+}
+
+// this function returns the position of the r-th (from 0) set bit of word
+static inline int select_bit(uint64_t word, int r) {
+#ifdef __BMI2__
+    return __builtin_ctzll(_pdep_u64(1ULL << r, word));
+#else
+    for (int j = 0; j < r; j++) {
+        word &= word - 1;
+    }
+    return __builtin_ctzll(word);
+#endif
+}
+
+// this function returns the position of the first docID >= k in an
+// Elias-Fano pack, which the caller knows holds one, and sets doc_id to it.
+// each zero of the upper bits closes the bucket of one high part, so the
+// values whose high part is below k's all come before zero number
+// high - 1. select finds that zero a popcount per word, and only the values
+// from k's bucket on are decoded
+size_t elias_fano_find(const unsigned char *input, int base, int k,
+                       int *doc_id) {
+    size_t n = input[0];
+    int l = input[1];
+    const unsigned char *low = input + 3;
+    const unsigned char *upper = low + (n * l + 7) / 8;
+    unsigned int value = (unsigned int)(k - base);
+    size_t high = value >> l;
+    size_t i = 0;   // first value of k's bucket
+    size_t bit = 0; // and where its upper bits start
+    uint64_t word;
+    size_t w = 0;
+    if (high > 0) {
+        size_t zeros = high - 1;
+        while (1) {
+            memcpy(&word, upper + 8 * w, sizeof(word));
+            size_t count = __builtin_popcountll(~word);
+            if (count > zeros) {
+                break;
+            }
+            zeros -= count;
+            w++;
+        }
+        bit = w * 64 + select_bit(~word, zeros) + 1;
+        i = bit - high;
+    }
+    w = bit / 64;
+    memcpy(&word, upper + 8 * w, sizeof(word));
+    word &= ~0ULL << (bit % 64);
+    while (1) {
+        while (!word) {
+            w++;
+            memcpy(&word, upper + 8 * w, sizeof(word));
+        }
+        size_t one = w * 64 + __builtin_ctzll(word);
+        unsigned int v = (unsigned int)((one - i) << l) |
+                         elias_fano_low(low, i, l);
+        if (v >= value) {
+            *doc_id = base + (int)v;
+            return i;
+        }
+        i++;
+        word &= word - 1;
+    }
+}
+
+// decodes one pack of docIDs, which carry on from prev_doc_id, with the codec
+// of the loaded index
+size_t decode_doc_pack(const unsigned char *input, int *output, size_t *count,
+                       int prev_doc_id) {
+    if (index_codec == CODEC_ELIAS_FANO) {
+        return elias_fano_decode(input, output, count, prev_doc_id);
+    }
+    size_t size = decode_pack(input, output, count);
+    prefix_sum(output, *count, prev_doc_id);
+    return size;
+}
+
+// function to decompress current docid and frequency block of a BP128 or
+// Stream VByte index, pack by pack. returns the number of postings decoded
+size_t decompress_block_packed(ListPointer *lp, PostingsList *postings_list) {
+    const unsigned char *input = d_block_data(lp, postings_list);
+    size_t i = 0;
+    size_t count;
+    SkipEntry *skip = &postings_list->skips[lp->curr_block];
+    int prev_doc_id = 0; // first pack in the block starts from an absolute
+                         // docID
+    while (1) {
+        if (i > MAX_BLOCK_POSTINGS - PACK_SIZE) {
+            // indexes written before blocks were capped can hold more
+            fprintf(stderr,
+                    "Error in docid decomp: too many postings in block %zu "
+                    "for term: %s\n",
+                    lp->curr_block, lp->term);
+            break;
+        }
+        input += decode_doc_pack(input, lp->curr_d_block_uncompressed + i,
+                                 &count, prev_doc_id);
+        if (count > 0) {
+            prev_doc_id = lp->curr_d_block_uncompressed[i + count - 1];
+        }
+        i += count;
+        // version 3 skip tables have the posting count, older indexes stop
+        // at the block's last docID
+        if (count == 0 || (skip->count ? i >= (size_t)skip->count
+                                       : prev_doc_id == skip->max_did)) {
+            break;
+        }
+    }
+
+    // the frequency packs line up with the docID packs
+    input = f_block_data(lp, postings_list);
+    size_t j = 0;
+    while (j < i) {
+        input += decode_pack(input, lp->curr_f_block_uncompressed + j, &count);
+        if (count == 0) {
+            fprintf(stderr,
+                    "Error in frequency decomp: empty pack in block %zu for "
+                    "term: %s\n",
+                    lp->curr_block, lp->term);
+            return i;
+        }
+        j += count;
+    }
+    return i;
+}
+
+// function to decompress current docid and frequency block. returns the
+// number of postings decoded
+size_t decompress_block(ListPointer *lp, PostingsList *postings_list) {
+    if (index_codec != CODEC_VARBYTE) {
+        return decompress_block_packed(lp, postings_list);
+    }
+
+    // decompress and write into uncompressed docid block in lp. the input is
+    // checked once per block here instead of once per varbyte, and the
+    // block's own size bounds the loop in case the last docID never shows up
+    const unsigned char *input = d_block_data(lp, postings_list);
+    const unsigned char *end = input + BLOCK_SIZE;
+    if (input[0] == '\0') {
+        fprintf(stderr,
+                "Error in docid decomp: empty block %zu for term: %s\n",
+                lp->curr_block, lp->term);
+        return 0;
+    }
+    int *output = lp->curr_d_block_uncompressed;
+    SkipEntry *skip = &postings_list->skips[lp->curr_block];
+    int last_doc_id_in_block = skip->max_did;
+    size_t i = 0;
+    if (skip->count) {
+        // version 3 skip tables have the posting count, no need to watch
+        // for the last docID
+        i = skip->count;
+        varbyte_decode_run(input, output, i);
+        prefix_sum(output, i, 0);
+    } else if (index_version == INDEX_VERSION_DGAP) {
+        // first posting in the block is absolute, the rest are gaps
+        int prev_doc_id = 0;
+        do {
+            input += varbyte_read(input, output + i);
+            output[i] += prev_doc_id;
+            prev_doc_id = output[i];
+        } while (output[i++] != last_doc_id_in_block && input < end);
+    } else {
+        do {
+            input += varbyte_read(input, output + i);
+        } while (output[i++] != last_doc_id_in_block && input < end);
+    }
+
+    // decompress and write into uncompressed frequency block in lp. stop
+    // after the number of docids decoded, because we pad the frequencies block
+    // with 0s!!
+    varbyte_decode_run(f_block_data(lp, postings_list),
+                       lp->curr_f_block_uncompressed, i);
+    return i;
+}
+
+// this function returns the first block at or after from whose last docID
+// is >= k, or num_blocks if there is none. it gallops forward over the skip
+// table and then binary searches the last step, so a seek costs O(log blocks
+// skipped)
+size_t find_block(SkipEntry *skips, size_t num_blocks, size_t from, int k) {
+    if (from >= num_blocks || skips[from].max_did >= k) {
+        return from;
+    }
+    size_t lo = from; // skips[lo].max_did < k
+    size_t step = 1;
+    while (lo + step < num_blocks && skips[lo + step].max_did < k) {
+        lo += step;
+        step *= 2;
+    }
+    size_t hi = lo + step < num_blocks ? lo + step : num_blocks;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (skips[mid].max_did < k) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return hi;
+}
+
+// this function returns the first sub-block in [from, to) whose last docID
+// is >= k. the caller has already found the block, so the answer is always
+// inside the range
+size_t find_sub_block(SubSkipEntry *sub_skips, size_t from, size_t to, int k) {
+    size_t lo = from;
+    size_t hi = to - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sub_skips[mid].max_did < k) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// this function returns how many of the sorted docIDs in [from, to) are less
+// than k, comparing 8 at a time with AVX2 (4 with SSE2)
+static inline size_t count_less(const int *doc_ids, size_t from, size_t to,
+                                int k) {
+    size_t count = 0;
+    size_t i = from;
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi32(k);
+    for (; i + 8 <= to; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(doc_ids + i));
+        __m256i less = _mm256_cmpgt_epi32(key, v);
+        count += __builtin_popcount(
+            _mm256_movemask_ps(_mm256_castsi256_ps(less)));
+    }
+#elif defined(__SSE2__)
+    __m128i key = _mm_set1_epi32(k);
+    for (; i + 4 <= to; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(doc_ids + i));
+        __m128i less = _mm_cmpgt_epi32(key, v);
+        count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(less)));
+    }
+#endif
+    for (; i < to; i++) {
+        count += doc_ids[i] < k;
+    }
+    return count;
+}
+
+// this function returns the position of the first docID >= k among the
+// decoded docIDs [from, size), or size if there is none. short seeks, the
+// common case in a disjunction, are answered by one compare of the next 8
+// docIDs. longer ones gallop forward like find_block and binary search the
+// last step, but stop once SEARCH_WINDOW docIDs are left and count the ones
+// below k with SIMD compares, so a seek costs O(log postings skipped)
+// instead of a walk over all of them
+size_t find_posting(const int *doc_ids, size_t from, size_t size, int k) {
+    size_t end = from + 8 < size ? from + 8 : size;
+    size_t count = count_less(doc_ids, from, end, k);
+    if (count < end - from || end == size) {
+        return from + count;
+    }
+    size_t lo = end - 1; // doc_ids[lo] < k
+    size_t step = 8;
+    while (lo + step < size && doc_ids[lo + step] < k) {
+        lo += step;
+        step *= 2;
+    }
+    size_t hi = lo + step < size ? lo + step : size; // doc_ids[hi] >= k
+    while (hi - lo > SEARCH_WINDOW) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (doc_ids[mid] < k) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo + 1 + count_less(doc_ids, lo + 1, hi, k);
+}
+
+// function to decompress the docIDs of a single sub-block of the current
+// block (version 4 indexes), its frequencies are left to get_freq. returns
+// the number of postings decoded. an Elias-Fano pack is only located, nextGEQ
+// searches it in place
+size_t decompress_sub_block(ListPointer *lp, PostingsList *postings_list,
+                            size_t sub) {
+    SkipEntry *skip = &postings_list->skips[lp->curr_block];
+    SubSkipEntry *sub_skip = &postings_list->sub_skips[sub];
+    size_t first = postings_list->first_sub_skip[lp->curr_block];
+    size_t count = skip->count - (sub - first) * SUB_BLOCK_SIZE;
+    if (count > SUB_BLOCK_SIZE) {
+        count = SUB_BLOCK_SIZE;
+    }
+    // the first sub-block starts from an absolute docID, the others carry on
+    // from the last docID of the sub-block before them
+    int prev_doc_id =
+        sub == first ? 0 : postings_list->sub_skips[sub - 1].max_did;
+    const unsigned char *d_input =
+        d_block_data(lp, postings_list) + sub_skip->d_offset;
+    if (index_codec == CODEC_ELIAS_FANO) {
+        lp->pack = d_input;
+        lp->pack_base = prev_doc_id;
+    } else if (index_codec == CODEC_VARBYTE) {
+        varbyte_decode_run(d_input, lp->curr_d_block_uncompressed, count);
+        prefix_sum(lp->curr_d_block_uncompressed, count, prev_doc_id);
+    } else {
+        // sub-blocks line up with the packs, so each one is a single pack
+        decode_doc_pack(d_input, lp->curr_d_block_uncompressed, &count,
+                        prev_doc_id);
+    }
+    return count;
+}
+
+// function to decompress the frequencies of the cursor's current sub-block.
+// without the frequency list in memory only the sub-block's bytes are read
+// from the index: up to the next sub-block, the term's end in its last
+// block, or at most MAX_SUB_BLOCK_BYTES
+void decompress_sub_block_freqs(ListPointer *lp, PostingsList *postings_list) {
+    SkipEntry *skip = &postings_list->skips[lp->curr_block];
+    size_t sub = lp->curr_sub_block;
+    size_t offset = postings_list->sub_skips[sub].f_offset;
+    const unsigned char *input;
+    unsigned char buffer[MAX_SUB_BLOCK_BYTES];
+    if (!reads_freqs_lazily() || postings_list->compressed_f_list) {
+        input = f_block_data(lp, postings_list) + offset;
+    } else {
+        size_t position = skip->f_offset + offset;
+        size_t size = BLOCK_SIZE - position % BLOCK_SIZE;
+        if (sub + 1 < postings_list->first_sub_skip[lp->curr_block + 1]) {
+            size = postings_list->sub_skips[sub + 1].f_offset - offset;
+        } else if (lp->curr_block == postings_list->num_blocks - 1) {
+            size = postings_list->last_f_offset - position % BLOCK_SIZE;
+        }
+        if (size > MAX_SUB_BLOCK_BYTES) {
+            size = MAX_SUB_BLOCK_BYTES;
+        }
+        read_index(postings_list, buffer, size, position);
+        input = buffer;
+    }
+    size_t count = lp->curr_size;
+    if (index_codec == CODEC_VARBYTE) {
+        varbyte_decode_run(input, lp->curr_f_block_uncompressed, count);
+    } else {
+        decode_pack(input, lp->curr_f_block_uncompressed, &count);
+    }
+}
+
+// the bitmap or array of container c of a bitmap term, from the mapped index
+// or fetched into the cursor's buffer
+static inline const unsigned char *
+container_data(ListPointer *lp, PostingsList *postings_list, size_t c) {
+    RoaringContainer *container = &postings_list->containers[c];
+    if (index_map) {
+        return index_map + skips_start + container->offset;
+    }
+    if (lp->fetched_container != c) {
+        if (!lp->container_buffer) {
+            lp->container_buffer = arena_alloc(
+                &query_arena, BITMAP_CONTAINER_WORDS * sizeof(uint64_t));
+        }
+        size_t size = container->cardinality > ARRAY_CONTAINER_MAX
+                          ? BITMAP_CONTAINER_WORDS * sizeof(uint64_t)
+                          : container->cardinality * sizeof(uint16_t);
+        read_index(postings_list, lp->container_buffer, size,
+                   skips_start + container->offset);
+        lp->fetched_container = c;
+    }
+    return lp->container_buffer;
+}
+
+// this function returns the position of the first value >= low in a sorted
+// array container of n values, or n if there is none
+size_t array_lower_bound(const uint16_t *array, size_t n, int low) {
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (array[mid] < low) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// this function returns the first docID of container c whose low 16 bits are
+// >= low, or -1 if there is none. bitmap containers are searched a 64-bit
+// word at a time
+int container_next(ListPointer *lp, PostingsList *postings_list, size_t c,
+                   int low) {
+    RoaringContainer *container = &postings_list->containers[c];
+    const unsigned char *data = container_data(lp, postings_list, c);
+    if (container->cardinality > ARRAY_CONTAINER_MAX) {
+        const uint64_t *words = (const uint64_t *)data;
+        size_t w = low >> 6;
+        uint64_t word = words[w] & (~0ULL << (low & 63));
+        while (!word) {
+            if (++w == BITMAP_CONTAINER_WORDS) {
+                return -1;
+            }
+            word = words[w];
+        }
+        return container->key << 16 | (int)(w * 64 + __builtin_ctzll(word));
+    }
+    const uint16_t *array = (const uint16_t *)data;
+    size_t i = array_lower_bound(array, container->cardinality, low);
+    return i < (size_t)container->cardinality ? container->key << 16 | array[i]
+                                               : -1;
+}
+
+// nextGEQ for a bitmap term: the container of k is found from the cursor's
+// on, and the docID is the next set bit (or array value) from k's low bits
+// there, or the first docID of the following container
+int bitmap_nextGEQ(ListPointer *lp, int k, PostingsList *postings_list) {
+    if (k <= lp->curr_doc_id) {
+        return lp->curr_doc_id;
+    }
+    if (k > postings_list->last_did) {
+        // no docID left at or after k, like nextGEQ
+        lp->curr_doc_id = postings_list->last_did;
+        return lp->curr_doc_id;
+    }
+    size_t c = lp->curr_container;
+    while (postings_list->containers[c].key < k >> 16) {
+        c++;
+    }
+    int doc_id = -1;
+    if (postings_list->containers[c].key == k >> 16) {
+        doc_id = container_next(lp, postings_list, c, k & 0xFFFF);
+    }
+    if (doc_id < 0) {
+        if (postings_list->containers[c].key == k >> 16) {
+            c++;
+        }
+        doc_id = container_next(lp, postings_list, c, 0);
+    }
+    if (c != lp->curr_container) {
+        lp->curr_container = c;
+        lp->rank_word = 0;
+        lp->rank_count = 0;
+    }
+    lp->curr_doc_id = doc_id;
+    lp->curr_freq = -1; // decoded by get_freq if the posting gets scored
+    return doc_id;
+}
+
+// this function works out the block, sub-block and position of a bitmap
+// cursor's posting from its rank among the term's docIDs, so get_freq can
+// decode its frequency like for any other list. ranks in a container carry on
+// from the cursor's previous posting: the words counted in a bitmap, or the
+// position reached in an array
+void locate_posting(ListPointer *lp, PostingsList *postings_list) {
+    RoaringContainer *container =
+        &postings_list->containers[lp->curr_container];
+    const unsigned char *data =
+        container_data(lp, postings_list, lp->curr_container);
+    int low = lp->curr_doc_id & 0xFFFF;
+    size_t rank;
+    if (container->cardinality > ARRAY_CONTAINER_MAX) {
+        const uint64_t *words = (const uint64_t *)data;
+        size_t w = low >> 6;
+        for (; lp->rank_word < w; lp->rank_word++) {
+            lp->rank_count += __builtin_popcountll(words[lp->rank_word]);
+        }
+        rank = lp->rank_count + __builtin_popcountll(
+                                    words[w] & ((1ULL << (low & 63)) - 1));
+    } else {
+        const uint16_t *array = (const uint16_t *)data;
+        while (array[lp->rank_word] < low) {
+            lp->rank_word++;
+        }
+        rank = lp->rank_word;
+    }
+    rank += container->rank;
+
+    size_t block = find_block(postings_list->skips, postings_list->num_blocks,
+                              lp->curr_block, lp->curr_doc_id);
+    size_t posting = rank - postings_list->block_ranks[block];
+    size_t sub =
+        postings_list->first_sub_skip[block] + posting / SUB_BLOCK_SIZE;
+    if (lp->compressed || block != lp->curr_block ||
+        sub != lp->curr_sub_block) {
+        if (!lp->curr_f_block_uncompressed) {
+            lp->curr_f_block_uncompressed =
+                arena_alloc(&query_arena, SUB_BLOCK_SIZE * sizeof(int));
+        }
+        size_t count = postings_list->skips[block].count -
+                       posting / SUB_BLOCK_SIZE * SUB_BLOCK_SIZE;
+        lp->curr_block = block;
+        lp->curr_sub_block = sub;
+        lp->curr_size = count < SUB_BLOCK_SIZE ? count : SUB_BLOCK_SIZE;
+        lp->compressed = 0;
+        lp->freqs_decoded = 0;
+    }
+    lp->curr_posting = posting % SUB_BLOCK_SIZE;
+}
+
+// function to get the next greatest or equal docID from a list
+int nextGEQ(ListPointer *lp, int k, PostingsList *postings_list) {
+    if (postings_list->containers) {
+        return bitmap_nextGEQ(lp, k, postings_list);
+    }
+    // implement block by block nextGEQ using the skip table
+    size_t block = find_block(postings_list->skips, postings_list->num_blocks,
+                              lp->curr_block, k);
+    if (block != lp->curr_block) {
+        lp->curr_block = block;
+        lp->compressed = 1;   // moving to new block, use this info to indicate
+                              // that the buffers need decoding again
+        lp->curr_posting = 0; // reset posting index to 0 for new block
+    }
+    if (lp->curr_block >= postings_list->num_blocks) {
+        // all of the docids in this list are less than k, terminate search
+        // we have either hit the end of the list or there are no results to
+        // be found
+        lp->curr_doc_id = postings_list->last_did;
+        return lp->curr_doc_id;
+    }
+
+    // at this point, lp->curr_block IS the block that contains the next
+    // greatest or equal docID
+
+    if (postings_list->sub_skips) {
+        // version 4 indexes: only the sub-block holding the next greatest or
+        // equal docID gets decoded, into buffers of one sub-block that the
+        // cursor keeps for its whole life
+        if (!lp->curr_d_block_uncompressed) {
+            lp->curr_d_block_uncompressed =
+                arena_alloc(&query_arena, SUB_BLOCK_SIZE * sizeof(int));
+            lp->curr_f_block_uncompressed =
+                arena_alloc(&query_arena, SUB_BLOCK_SIZE * sizeof(int));
+        }
+        size_t from = lp->compressed
+                          ? postings_list->first_sub_skip[lp->curr_block]
+                          : lp->curr_sub_block;
+        size_t sub = find_sub_block(
+            postings_list->sub_skips, from,
+            postings_list->first_sub_skip[lp->curr_block + 1], k);
+        if (lp->compressed || sub != lp->curr_sub_block) {
+            lp->curr_size = decompress_sub_block(lp, postings_list, sub);
+            lp->curr_sub_block = sub;
+            lp->curr_posting = 0;
+            lp->compressed = 0;
+            lp->freqs_decoded = 0;
+        }
+    } else if (lp->compressed) {
+        // older indexes decode whole blocks, into buffers the cursor keeps
+        // from block to block. nothing past the decoded postings is read, so
+        // they are not cleared
+        if (!lp->curr_d_block_uncompressed) {
+            lp->curr_d_block_uncompressed =
+                arena_alloc(&query_arena, MAX_BLOCK_POSTINGS * sizeof(int));
+            lp->curr_f_block_uncompressed =
+                arena_alloc(&query_arena, MAX_BLOCK_POSTINGS * sizeof(int));
+        }
+        lp->curr_size = decompress_block(lp, postings_list);
+        lp->compressed = 0;
+    }
+
+    if (lp->pack) {
+        // select in the Elias-Fano pack, unless the cursor is already there
+        if (k > lp->curr_doc_id) {
+            lp->curr_posting = elias_fano_find(lp->pack, lp->pack_base, k,
+                                               &lp->curr_doc_id);
+            lp->curr_freq = -1;
+        }
+        return lp->curr_doc_id;
+    }
+
+    // search the decoded block (or sub-block) for the next greatest or equal
+    // docID, its last docID is >= k so it is always there
+    lp->curr_posting = find_posting(lp->curr_d_block_uncompressed,
+                                    lp->curr_posting, lp->curr_size, k);
+    if (lp->curr_posting >= lp->curr_size) {
+        // if we reach here, something has gone wrong
+        return -1;
+    }
+    lp->curr_doc_id = lp->curr_d_block_uncompressed[lp->curr_posting];
+    lp->curr_freq = postings_list->sub_skips
+                        ? -1 // decoded by get_freq if the posting gets scored
+                        : lp->curr_f_block_uncompressed[lp->curr_posting];
+    return lp->curr_doc_id;
+}
+
+// function to get the frequency (or impact) of the cursor's current posting,
+// decoding its sub-block's frequencies the first time one of them is needed
+int get_freq(ListPointer *lp, PostingsList *postings_list) {
+    if (lp->curr_freq < 0) {
+        if (postings_list->containers) {
+            locate_posting(lp, postings_list);
+        }
+        if (!lp->freqs_decoded) {
+            decompress_sub_block_freqs(lp, postings_list);
+            lp->freqs_decoded = 1;
+        }
+        lp->curr_freq = lp->curr_f_block_uncompressed[lp->curr_posting];
+    }
+    return lp->curr_freq;
+}
+
+// map the binary doc table written by the generator, the lengths are used in
+// place. returns 0 if the file does not exist
+int map_doc_table(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("Error reading doc table size");
+        exit(EXIT_FAILURE);
+    }
+    size_t size = st.st_size;
+    if (size < sizeof(DocTableHeader)) {
+        fprintf(stderr, "Doc table %s is truncated\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Error mapping doc table");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    const DocTableHeader *header = map;
+    if (memcmp(header->magic, DOC_TABLE_MAGIC, sizeof(header->magic)) != 0 ||
+        size != sizeof(DocTableHeader) + header->table_size * sizeof(int)) {
+        fprintf(stderr, "Doc table %s is corrupt\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    num_documents = header->num_docs;
+    avg_doc_length = header->avg_length;
+    doc_table = (int *)(header + 1);
+    doc_table_size = header->table_size;
+    return 1;
+}
+
+// decodes a value of long_to_int4 in the generator (Lucene's
+// SmallFloat.int4ToLong), the smallest length that maps to it
+int int4_to_long(int value) {
+    int bits = value & 0x07;
+    int shift = (value >> 3) - 1;
+    return shift < 0 ? bits : (bits | 0x08) << shift;
+}
+
+// map the quantized norms and precompute the BM25 length factor of every
+// norm, needs the collection statistics to be loaded first
+void map_norms(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening norms.bin, rebuild the index to get it");
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("Error reading norms size");
+        exit(EXIT_FAILURE);
+    }
+    size_t size = st.st_size;
+    if (size < sizeof(NormsHeader)) {
+        fprintf(stderr, "Norms %s are truncated\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Error mapping norms");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    const NormsHeader *header = map;
+    if (memcmp(header->magic, NORMS_MAGIC, sizeof(header->magic)) != 0 ||
+        size != sizeof(NormsHeader) + header->table_size) {
+        fprintf(stderr, "Norms %s are corrupt\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    norms = (const unsigned char *)(header + 1);
+    norms_size = header->table_size;
+    for (int v = 0; v < 256; v++) {
+        int length = v;
+        if (v >= NORMS_FREE_VALUES) {
+            length = NORMS_FREE_VALUES + int4_to_long(v - NORMS_FREE_VALUES);
+        }
+        norm_factors[v] =
+            BM25_K1 * (1.0 - BM25_B + BM25_B * (length / avg_doc_length));
+    }
+}
+
+// this function loads the document lengths from a file into memory, for
+// index directories without docs.bin. the collection statistics are computed
+// on the way
+void load_doc_lengths(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        perror("Error opening document lengths file");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t capacity = 1024;
+    doc_table = (int *)calloc(capacity, sizeof(int));
+    if (!doc_table) {
+        perror("Error allocating memory for doc table");
+        exit(EXIT_FAILURE);
+    }
+
+    int doc_id;
+    int doc_length;
+    size_t total_length = 0;
+    while (fscanf(file, "%d %d", &doc_id, &doc_length) == 2) {
+        if (doc_id < 0) {
+            continue;
+        }
+        while ((size_t)doc_id >= capacity) {
+            doc_table = realloc(doc_table, sizeof(int) * capacity * 2);
+            if (!doc_table) {
+                perror("Error reallocating memory for doc table");
+                exit(EXIT_FAILURE);
+            }
+            memset(doc_table + capacity, 0, sizeof(int) * capacity);
+            capacity *= 2;
+        }
+        doc_table[doc_id] = doc_length;
+        if ((size_t)doc_id >= doc_table_size) {
+            doc_table_size = doc_id + 1;
+        }
+        num_documents++;
+        total_length += doc_length;
+    }
+    if (num_documents > 0) {
+        avg_doc_length = (double)total_length / num_documents;
+    }
+
+    fclose(file);
+}
+
+// function to calculate BM25 score of a single word in a document
+double get_score(int freq, int doc_id, int num_entries) {
+    double k1 = BM25_K1;
+    double b = BM25_B;
+
+    double score;
+    int f = freq; // term frequency in this document
+    double tf = 0.0;
+    double numerator = f * (k1 + 1.0);
+    double denominator;
+    if (use_norms) {
+        denominator = f + norm_factors[norms[doc_id]];
+    } else {
+        int d = doc_table[doc_id]; // length of this document
+        denominator = f + k1 * (1.0 - b + b * (d / avg_doc_length));
+    }
+    tf = numerator / denominator;
+    double idf;
+    denominator = num_entries + 0.5;
+    numerator = (double)num_documents - num_entries + 0.5;
+    idf = log((numerator / denominator) + 1.0);
+    score = (idf * tf);
+
+    return score;
+}
+
+// precompute the length factor of every docID for the batch scorer, needs
+// the doc table (and with -n the norms) to be loaded first
+void build_doc_factors() {
+    size_t size = use_norms ? norms_size : doc_table_size;
+    doc_factors = malloc((size ? size : 1) * sizeof(float));
+    if (!doc_factors) {
+        perror("Error allocating memory for doc factors");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t d = 0; d < size; d++) {
+        if (use_norms) {
+            doc_factors[d] = norm_factors[norms[d]];
+        } else {
+            doc_factors[d] = BM25_K1 * (1.0 - BM25_B + BM25_B *
+                                        (doc_table[d] / avg_doc_length));
+        }
+    }
+}
+
+// the part of a term's BM25 score that is the same for all its postings,
+// idf * (k1 + 1). computed once per query term, a posting with frequency f in
+// document d then scores weight * f / (f + doc_factors[d])
+float term_weight(int num_entries) {
+    double idf = log(((double)num_documents - num_entries + 0.5) /
+                         (num_entries + 0.5) +
+                     1.0);
+    return idf * (BM25_K1 + 1.0);
+}
+
+static inline float term_score(float weight, int freq, int doc_id) {
+    float f = freq;
+    return weight * f / (f + doc_factors[doc_id]);
+}
+
+// batch BM25 scorer: writes the scores of n postings of one term, given by
+// their docIDs and frequencies, to scores. with AVX2, 8 postings at a time
+// gather their length factors and share one multiply and one divide
+void score_postings(float weight, const int *doc_ids, const int *freqs,
+                    size_t n, float *scores) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256 w = _mm256_set1_ps(weight);
+    for (; i < (n & ~(size_t)7); i += 8) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)(doc_ids + i));
+        __m256 k = _mm256_i32gather_ps(doc_factors, d, sizeof(float));
+        __m256 f = _mm256_cvtepi32_ps(
+            _mm256_loadu_si256((const __m256i *)(freqs + i)));
+        __m256 score =
+            _mm256_div_ps(_mm256_mul_ps(w, f), _mm256_add_ps(f, k));
+        _mm256_storeu_ps(scores + i, score);
+    }
+#endif
+    for (; i < n; i++) {
+        scores[i] = term_score(weight, freqs[i], doc_ids[i]);
+    }
 }
 
 // function to calculate BM25 score of a document
-int calculate_score(ListPointer **lp, int num_terms) {
+double calculate_score(ListPointer **lp, PostingsList *postings_lists,
+                    int num_terms) {
+    if (impact_scale) {
+        int impact = 0;
+        for (int i = 0; i < num_terms; i++) {
+            impact += get_freq(lp[i], &postings_lists[i]);
+        }
+        return impact * impact_scale;
+    }
     double score = 0;
     for (int i = 0; i < num_terms; i++) {
-        score +=
-            get_score(lp[i]->curr_freq, lp[i]->curr_doc_id, lp[i]->num_entries);
+        score += get_score(get_freq(lp[i], &postings_lists[i]),
+                           lp[i]->curr_doc_id, lp[i]->num_entries);
     }
     return score;
 }
 
+// this function writes the docIDs found in both sorted arrays a and b to
+// out, and returns how many there are. with SSE2, 4 docIDs of a are compared
+// with 4 of b at once by rotating b through the lanes (Schlegel et al.,
+// Lemire et al.), then the 4 with the smaller last docID move on. the tails
+// are merged one docID at a time
+size_t intersect(const int *a, size_t na, const int *b, size_t nb, int *out) {
+    size_t i = 0, j = 0, n = 0;
+#ifdef __SSE2__
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + j));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x39))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x4E)),
+                         _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x93))));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        while (mask) {
+            out[n++] = a[i + __builtin_ctz(mask)];
+            mask &= mask - 1;
+        }
+        int a_last = a[i + 3];
+        int b_last = b[j + 3];
+        i += a_last <= b_last ? 4 : 0;
+        j += b_last <= a_last ? 4 : 0;
+    }
+#endif
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (a[i] > b[j]) {
+            j++;
+        } else {
+            out[n++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    return n;
+}
+
+// this function writes the docIDs two bitmap terms share in the container of
+// the first one's cursor to out, from both cursors on, and returns how many
+// there are. two bitmaps are ANDed a 64-bit word at a time, an array is
+// tested against the other container's bits or merged with the other array
+size_t intersect_containers(ListPointer *lp_a, PostingsList *postings_list_a,
+                            ListPointer *lp_b, PostingsList *postings_list_b,
+                            int *out) {
+    RoaringContainer *a = &postings_list_a->containers[lp_a->curr_container];
+    RoaringContainer *b = &postings_list_b->containers[lp_b->curr_container];
+    if (a->key != b->key) {
+        return 0;
+    }
+    const unsigned char *a_data =
+        container_data(lp_a, postings_list_a, lp_a->curr_container);
+    const unsigned char *b_data =
+        container_data(lp_b, postings_list_b, lp_b->curr_container);
+    int from = lp_a->curr_doc_id > lp_b->curr_doc_id ? lp_a->curr_doc_id
+                                                     : lp_b->curr_doc_id;
+    int low = from & 0xFFFF;
+    int high = a->key << 16;
+    size_t n = 0;
+    if (a->cardinality > ARRAY_CONTAINER_MAX &&
+        b->cardinality > ARRAY_CONTAINER_MAX) {
+        const uint64_t *a_words = (const uint64_t *)a_data;
+        const uint64_t *b_words = (const uint64_t *)b_data;
+        uint64_t mask = ~0ULL << (low & 63); // first word, from low on
+        for (size_t w = low >> 6; w < BITMAP_CONTAINER_WORDS; w++) {
+            uint64_t word = a_words[w] & b_words[w] & mask;
+            while (word) {
+                out[n++] = high | (int)(w * 64 + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+            mask = ~0ULL;
+        }
+    } else if (a->cardinality > ARRAY_CONTAINER_MAX ||
+               b->cardinality > ARRAY_CONTAINER_MAX) {
+        int a_bitmap = a->cardinality > ARRAY_CONTAINER_MAX;
+        const uint64_t *words = (const uint64_t *)(a_bitmap ? a_data : b_data);
+        const uint16_t *array = (const uint16_t *)(a_bitmap ? b_data : a_data);
+        size_t count = a_bitmap ? b->cardinality : a->cardinality;
+        for (size_t i = array_lower_bound(array, count, low); i < count; i++) {
+            if (words[array[i] >> 6] >> (array[i] & 63) & 1) {
+                out[n++] = high | array[i];
+            }
+        }
+    } else {
+        const uint16_t *a_array = (const uint16_t *)a_data;
+        const uint16_t *b_array = (const uint16_t *)b_data;
+        size_t i = array_lower_bound(a_array, a->cardinality, low);
+        size_t j = array_lower_bound(b_array, b->cardinality, low);
+        while (i < (size_t)a->cardinality && j < (size_t)b->cardinality) {
+            if (a_array[i] < b_array[j]) {
+                i++;
+            } else if (a_array[i] > b_array[j]) {
+                j++;
+            } else {
+                out[n++] = high | a_array[i];
+                i++;
+                j++;
+            }
+        }
+    }
+    return n;
+}
+
+// decodes the Elias-Fano pack a cursor searches in place into its buffer, for
+// c_DAAT to intersect
+void decode_cursor_pack(ListPointer *lp) {
+    size_t count;
+    elias_fano_decode(lp->pack, lp->curr_d_block_uncompressed, &count,
+                      lp->pack_base);
+    lp->pack = NULL;
+}
+
+// moves a cursor to docID k, which is among the docIDs it has decoded (or in
+// a bitmap term's current container), like nextGEQ without the skip table
+// lookups
+static inline void seek_decoded(ListPointer *lp, int k,
+                                PostingsList *postings_list) {
+    if (postings_list->containers) {
+        // k is one of the docIDs of the bitmap term's current container
+        lp->curr_doc_id = k;
+        lp->curr_freq = -1;
+        return;
+    }
+    while (lp->curr_d_block_uncompressed[lp->curr_posting] < k) {
+        lp->curr_posting++;
+    }
+    lp->curr_doc_id = k;
+    lp->curr_freq = postings_list->sub_skips
+                        ? -1 // decoded by get_freq if the posting gets scored
+                        : lp->curr_f_block_uncompressed[lp->curr_posting];
+}
+
+// the documents c_DAAT has found in all lists but not scored yet, with the
+// frequency of every query term in them. once SCORE_BATCH are collected they
+// are scored a term at a time with the batch scorer, summed and inserted
+typedef struct {
+    int *doc_ids;
+    int *freqs; // SCORE_BATCH frequencies per query term
+    float *scores;
+    double *sums;
+    float *weights; // term_weight of each query term
+    size_t num_terms;
+    size_t size;
+} HitBuffer;
+
+HitBuffer *open_hit_buffer(PostingsList *postings_lists, size_t num_terms) {
+    HitBuffer *hits = arena_alloc(&query_arena, sizeof(HitBuffer));
+    hits->doc_ids = arena_alloc(&query_arena, SCORE_BATCH * sizeof(int));
+    hits->scores = arena_alloc(&query_arena, SCORE_BATCH * sizeof(float));
+    hits->sums = arena_alloc(&query_arena, SCORE_BATCH * sizeof(double));
+    hits->freqs =
+        arena_alloc(&query_arena, num_terms * SCORE_BATCH * sizeof(int));
+    hits->weights = arena_alloc(&query_arena, num_terms * sizeof(float));
+    for (size_t t = 0; t < num_terms; t++) {
+        hits->weights[t] = term_weight(postings_lists[t].num_entries);
+    }
+    hits->num_terms = num_terms;
+    hits->size = 0;
+    return hits;
+}
+
+void flush_hits(HitBuffer *hits, MinHeap *top_k) {
+    size_t n = hits->size;
+    memset(hits->sums, 0, n * sizeof(double));
+    for (size_t t = 0; t < hits->num_terms; t++) {
+        score_postings(hits->weights[t], hits->doc_ids,
+                       hits->freqs + t * SCORE_BATCH, n, hits->scores);
+        for (size_t h = 0; h < n; h++) {
+            hits->sums[h] += hits->scores[h];
+        }
+    }
+    for (size_t h = 0; h < n; h++) {
+        insert(top_k, hits->doc_ids[h], hits->sums[h]);
+    }
+    hits->size = 0;
+}
+
+// collects the document all cursors are on, while they still are. impact
+// indexes have no length factors to batch and are scored right away
+void add_hit(HitBuffer *hits, ListPointer **lp, PostingsList *postings_lists,
+             MinHeap *top_k) {
+    int did = lp[0]->curr_doc_id;
+    if (impact_scale) {
+        insert(top_k, did,
+               calculate_score(lp, postings_lists, hits->num_terms));
+        return;
+    }
+    size_t h = hits->size++;
+    hits->doc_ids[h] = did;
+    for (size_t t = 0; t < hits->num_terms; t++) {
+        hits->freqs[t * SCORE_BATCH + h] = get_freq(lp[t], &postings_lists[t]);
+    }
+    if (hits->size == SCORE_BATCH) {
+        flush_hits(hits, top_k);
+    }
+}
+
 void c_DAAT(PostingsList *postings_lists, size_t num_terms, MinHeap *top_k) {
+    if (num_terms == 0) {
+        return; // lp[0] below is the cursor every candidate comes from
+    }
 
     // step 1 - arrange the lists in order of increasing size of  docID lists
     qsort(postings_lists, num_terms, sizeof(PostingsList),
@@ -581,54 +2450,114 @@ void c_DAAT(PostingsList *postings_lists, size_t num_terms, MinHeap *top_k) {
         lp[i] = open_list(&postings_lists[i]);
     }
 
-    int did = 0;
-    int max_did = postings_lists[0]
-                      .last_did; // this is the max docID in the shortest list
-
-    // step 3 - traversal
-    while (did <= max_did) {
-        // get next post from shortest list
-        did = nextGEQ(lp[0], did, &postings_lists[0]);
-        // check if did is in all other lists, if not, check next greatest docID
-        int d;
-        size_t j;
-        for (j = 1; j < num_terms; j++) {
-            d = nextGEQ(lp[j], did, &postings_lists[j]);
-            if (d != did) {
-                break;
+    // the documents in all lists are scored in batches
+    HitBuffer *hits = open_hit_buffer(postings_lists, num_terms);
+
+    int did = nextGEQ(lp[0], 0, &postings_lists[0]);
+    if (num_terms == 1) {
+        // if there is only one term, then every docID in its list is a result
+        while (1) {
+            add_hit(hits, lp, postings_lists, top_k);
+            if (did >= postings_lists[0].last_did) {
+                flush_hits(hits, top_k);
+                return;
             }
+            did = nextGEQ(lp[0], did + 1, &postings_lists[0]);
         }
-        if (num_terms == 1) {
-            // if there is only one term, then we know that the docID are in
-            // "all" of the lists we want to keep going along this list and find
-            // the top k BM25 scores
-            d = did;
+    }
+
+    // step 3 - traversal, a decoded block (or sub-block) at a time. the
+    // docIDs the two shortest lists have decoded from their cursors on are
+    // intersected with SIMD compares, and only the ones in both are looked
+    // up in the other lists. a bitmap term goes a Roaring container at a
+    // time instead: two of them are intersected with word-level ANDs, and
+    // the decoded docIDs of a shorter list are just tested against the bits
+    // of a bitmap term. the lists are sorted by length, so when the first
+    // list is a bitmap term the second one is too. Elias-Fano packs are
+    // decoded for the intersection, except in a second list PROBE_SKEW times
+    // longer than the first: that one is probed with select like a bitmap
+    size_t capacity = postings_lists[0].containers ? 65536
+                      : postings_lists[0].sub_skips ? SUB_BLOCK_SIZE
+                                                    : MAX_BLOCK_POSTINGS;
+    int *matches = arena_alloc(&query_arena, capacity * sizeof(int));
+    int d = nextGEQ(lp[1], did, &postings_lists[1]);
+    while (d >= did) {
+        const int *candidates = matches;
+        size_t num_matches;
+        size_t first_probe = 2; // first list the candidates are looked up in
+        int last;
+        if (postings_lists[0].containers) {
+            last = did | 0xFFFF;
+            num_matches = intersect_containers(lp[0], &postings_lists[0],
+                                               lp[1], &postings_lists[1],
+                                               matches);
+        } else {
+            if (lp[0]->pack) {
+                decode_cursor_pack(lp[0]);
+            }
+            const int *a =
+                lp[0]->curr_d_block_uncompressed + lp[0]->curr_posting;
+            size_t na = lp[0]->curr_size - lp[0]->curr_posting;
+            last = a[na - 1];
+            int probe = lp[1]->pack && postings_lists[1].num_entries >=
+                                           PROBE_SKEW *
+                                               postings_lists[0].num_entries;
+            if (postings_lists[1].containers || probe) {
+                candidates = a;
+                num_matches = na;
+                first_probe = 1;
+            } else {
+                if (lp[1]->pack) {
+                    decode_cursor_pack(lp[1]);
+                }
+                const int *b =
+                    lp[1]->curr_d_block_uncompressed + lp[1]->curr_posting;
+                size_t nb = lp[1]->curr_size - lp[1]->curr_posting;
+                if (b[nb - 1] < last) {
+                    last = b[nb - 1];
+                }
+                num_matches = intersect(a, na, b, nb, matches);
+            }
         }
-        if (d > did) {
-            // we know that the docID is not in all lists
-            // check next greatest docID from next list
-            did = d;
-        } else if (d < did) {
-            // if all the docids in the next shortest list are less than the
-            // first element in the shortest list, then we know that there are
-            // no documents that contain both terms search terminated early,
-            for (i = 0; i < num_terms; i++) {
-                close_list(lp[i]);
+
+        for (size_t m = 0; m < num_matches; m++) {
+            // the first lists have the docID, check if it is in all other
+            // lists
+            did = candidates[m];
+            for (size_t j = 0; j < first_probe; j++) {
+                seek_decoded(lp[j], did, &postings_lists[j]);
+            }
+            d = did;
+            size_t j;
+            for (j = first_probe; j < num_terms; j++) {
+                d = nextGEQ(lp[j], did, &postings_lists[j]);
+                if (d != did) {
+                    break;
+                }
+            }
+            if (d < did) {
+                // if all the docids in a list are less than the docID, then
+                // no more documents contain all terms, search terminated early
+                flush_hits(hits, top_k);
+                return;
             }
+            if (j == num_terms) {
+                // we know that the docID is in all lists, collect it for
+                // BM25 scoring
+                add_hit(hits, lp, postings_lists, top_k);
+            }
+        }
+
+        // move both lists past the decoded docIDs that ran out first, a list
+        // that has no docID left there ends the search
+        did = nextGEQ(lp[0], last + 1, &postings_lists[0]);
+        if (did <= last) {
+            flush_hits(hits, top_k);
             return;
-        } else {
-            // we know that the docID is in all lists, or the only list
-            // calculate BM25 score
-            double score = calculate_score(lp, num_terms);
-            // insert into heap
-            insert(top_k, did, score);
-            did++;
         }
+        d = nextGEQ(lp[1], did, &postings_lists[1]);
     }
-    // step 4 - close all lists
-    for (i = 0; i < num_terms; i++) {
-        close_list(lp[i]);
-    }
+    flush_hits(hits, top_k);
 }
 
 int compare_list_pointers(const void *a, const void *b) {
@@ -657,9 +2586,11 @@ void d_DAAT(PostingsList *postings_lists, size_t num_terms, MinHeap *top_k) {
 
     int greatest_doc_id = postings_lists[0].last_did;
     ListPointer *lp[num_terms];
+    float weights[num_terms]; // the per-term BM25 constants
     size_t i;
     for (i = 0; i < num_terms; i++) {
         lp[i] = open_list(&postings_lists[i]);
+        weights[i] = term_weight(postings_lists[i].num_entries);
         lp[i]->curr_doc_id = nextGEQ(lp[i], 0, &postings_lists[i]);
         if (postings_lists[i].last_did > greatest_doc_id) {
             // store greatest doc id out of all terms to limit search
@@ -675,12 +2606,18 @@ void d_DAAT(PostingsList *postings_lists, size_t num_terms, MinHeap *top_k) {
     double score; // start with the score from the first list
 
     while (1) {
-        score = 0; // reset score for new docID
+        score = 0;      // reset score for new docID
+        int impact = 0; // sum of the quantized impacts, impact indexes only
         // sum up score for current did
         for (i = 0; i < num_terms; i++) {
             if (lp[i]->curr_doc_id == did) {
-                score += get_score(lp[i]->curr_freq, lp[i]->curr_doc_id,
-                                   lp[i]->num_entries); // add to score
+                if (impact_scale) {
+                    impact += get_freq(lp[i], &postings_lists[i]);
+                } else {
+                    score += term_score(weights[i],
+                                        get_freq(lp[i], &postings_lists[i]),
+                                        did); // add to score
+                }
                 if (lp[i]->curr_doc_id >= postings_lists[i].last_did) {
                     lp[i]->curr_doc_id = -1; // no more docIDs in this list
                 } else {
@@ -690,6 +2627,9 @@ void d_DAAT(PostingsList *postings_lists, size_t num_terms, MinHeap *top_k) {
                 }
             }
         }
+        if (impact_scale) {
+            score = impact * impact_scale;
+        }
         insert(top_k, did, score);
 
         // advance posting list with lowest current docID
@@ -702,24 +2642,773 @@ void d_DAAT(PostingsList *postings_lists, size_t num_terms, MinHeap *top_k) {
         }
         did = lp[lowest_doc_id_index]->curr_doc_id;
     }
+}
+
+// moves a cursor to the next greatest or equal docID like nextGEQ, but sets
+// the docID to INT_MAX once the list has nothing left at or after k
+int next_or_end(ListPointer *lp, int k, PostingsList *postings_list) {
+    if (k > postings_list->last_did) {
+        lp->curr_doc_id = INT_MAX;
+        return INT_MAX;
+    }
+    return nextGEQ(lp, k, postings_list);
+}
+
+// returns the largest score of the sub-block of a list that would hold docID
+// k, and sets end to the last docID of that sub-block. only the skip tables
+// are searched, nothing is decoded and the cursor does not move
+double block_max_score(ListPointer *lp, PostingsList *postings_list, int k,
+                       int *end) {
+    size_t block = find_block(postings_list->skips, postings_list->num_blocks,
+                              lp->curr_block, k);
+    if (block >= postings_list->num_blocks) {
+        *end = INT_MAX;
+        return 0;
+    }
+    size_t from = block == lp->curr_block && !lp->compressed
+                      ? lp->curr_sub_block
+                      : postings_list->first_sub_skip[block];
+    size_t sub = find_sub_block(postings_list->sub_skips, from,
+                                postings_list->first_sub_skip[block + 1], k);
+    *end = postings_list->sub_skips[sub].max_did;
+    return postings_list->sub_max_scores[sub];
+}
+
+// sorts the positions of the cursors by their current docID, they are almost
+// sorted already
+void sort_by_doc_id(size_t *order, ListPointer **lp, size_t num_terms) {
+    for (size_t i = 1; i < num_terms; i++) {
+        size_t t = order[i];
+        size_t j = i;
+        while (j > 0 && lp[order[j - 1]]->curr_doc_id > lp[t]->curr_doc_id) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = t;
+    }
+}
+
+// disjunctive top-k with Block-Max WAND (Ding and Suel). the cursors are kept
+// sorted by docID and the pivot is the first docID where the term maximum
+// scores add up to more than the smallest score in the full heap. the pivot
+// is only scored if the sub-block maximums at it also beat the heap,
+// otherwise the search jumps past the end of the nearest sub-block. a
+// document is skipped only when it could not have entered the heap, so the
+// top k is the one d_DAAT finds
+void bmw_DAAT(PostingsList *postings_lists, size_t num_terms, MinHeap *top_k) {
+    if (!postings_lists[0].sub_max_scores) {
+        // no score bounds to skip with, evaluate every document
+        printf("Index version %d has no block-max scores, rebuild it to skip "
+               "documents\n",
+               index_version);
+        d_DAAT(postings_lists, num_terms, top_k);
+        return;
+    }
+
+    // lp keeps the query order so documents are scored the way d_DAAT scores
+    // them, order holds the positions in lp sorted by docID
+    ListPointer *lp[num_terms];
+    size_t order[num_terms];
+    float weights[num_terms]; // the per-term BM25 constants, as in d_DAAT
+    size_t i;
+    for (i = 0; i < num_terms; i++) {
+        lp[i] = open_list(&postings_lists[i]);
+        next_or_end(lp[i], 0, &postings_lists[i]);
+        order[i] = i;
+        weights[i] = term_weight(postings_lists[i].num_entries);
+    }
+
+    while (1) {
+        sort_by_doc_id(order, lp, num_terms);
+        double threshold =
+            top_k->size < top_k->capacity ? -1 : top_k->nodes[0].score;
+
+        // find the pivot, the first list where the maximum scores of the
+        // lists up to it beat the threshold
+        double bound = 0;
+        size_t pivot;
+        for (pivot = 0; pivot < num_terms; pivot++) {
+            if (lp[order[pivot]]->curr_doc_id == INT_MAX) {
+                pivot = num_terms;
+                break;
+            }
+            bound += postings_lists[order[pivot]].max_score * (1 + BOUND_SLACK);
+            if (bound > threshold) {
+                break;
+            }
+        }
+        if (pivot == num_terms) {
+            break; // no document left can make the top k
+        }
+        int pivot_doc_id = lp[order[pivot]]->curr_doc_id;
+        while (pivot + 1 < num_terms &&
+               lp[order[pivot + 1]]->curr_doc_id == pivot_doc_id) {
+            pivot++;
+        }
+
+        // check the pivot against the sub-block maximums of its lists, and
+        // find where the nearest of those sub-blocks ends
+        double block_bound = 0;
+        int next_doc_id = pivot + 1 < num_terms
+                              ? lp[order[pivot + 1]]->curr_doc_id
+                              : INT_MAX;
+        for (i = 0; i <= pivot; i++) {
+            int end;
+            block_bound +=
+                block_max_score(lp[order[i]], &postings_lists[order[i]],
+                                pivot_doc_id, &end) *
+                (1 + BOUND_SLACK);
+            if (end < next_doc_id - 1) {
+                next_doc_id = end + 1;
+            }
+        }
+
+        if (block_bound > threshold) {
+            if (lp[order[0]]->curr_doc_id == pivot_doc_id) {
+                // all lists up to the pivot are on it, score the document
+                double score = 0;
+                int impact = 0;
+                for (i = 0; i < num_terms; i++) {
+                    if (lp[i]->curr_doc_id != pivot_doc_id) {
+                        continue;
+                    }
+                    int freq = get_freq(lp[i], &postings_lists[i]);
+                    if (impact_scale) {
+                        impact += freq;
+                    } else {
+                        score += term_score(weights[i], freq, pivot_doc_id);
+                    }
+                    next_or_end(lp[i], pivot_doc_id + 1, &postings_lists[i]);
+                }
+                if (impact_scale) {
+                    score = impact * impact_scale;
+                }
+                insert(top_k, pivot_doc_id, score);
+            } else {
+                // move the last list before the pivot up to it
+                size_t j = pivot;
+                while (lp[order[j]]->curr_doc_id == pivot_doc_id) {
+                    j--;
+                }
+                next_or_end(lp[order[j]], pivot_doc_id,
+                            &postings_lists[order[j]]);
+            }
+        } else {
+            // nothing before the end of the nearest sub-block can beat the
+            // threshold, move the list with the largest maximum score past it
+            size_t j = 0;
+            for (i = 1; i <= pivot; i++) {
+                if (postings_lists[order[i]].max_score >
+                    postings_lists[order[j]].max_score) {
+                    j = i;
+                }
+            }
+            next_or_end(lp[order[j]], next_doc_id, &postings_lists[order[j]]);
+        }
+    }
+}
+
+// orders positions of postings lists by the term's maximum score, for
+// maxscore_DAAT
+PostingsList *maxscore_lists = NULL;
 
+int compare_max_scores(const void *a, const void *b) {
+    size_t i = *(const size_t *)a;
+    size_t j = *(const size_t *)b;
+    double diff = maxscore_lists[i].max_score - maxscore_lists[j].max_score;
+    if (diff != 0) {
+        return diff < 0 ? -1 : 1;
+    }
+    return i < j ? -1 : i > j;
+}
+
+// disjunctive top-k with MaxScore (Turtle and Flood). the lists are sorted by
+// the term's maximum score and the ones whose maximums add up to no more than
+// the smallest score in the full heap are non-essential: a document in only
+// those lists cannot make the top k. the essential lists drive the traversal,
+// and the non-essential ones are only probed with nextGEQ for the documents
+// the essential lists produce, from the highest maximum down, until the rest
+// of the maximums cannot lift the document into the heap. scores are summed
+// in query order, so the top k is the one d_DAAT finds
+void maxscore_DAAT(PostingsList *postings_lists, size_t num_terms,
+                   MinHeap *top_k) {
+    if (index_version < INDEX_VERSION_BLOCKMAX) {
+        // no maximum scores to split the lists with, evaluate every document
+        printf("Index version %d has no maximum scores, rebuild it to skip "
+               "documents\n",
+               index_version);
+        d_DAAT(postings_lists, num_terms, top_k);
+        return;
+    }
+
+    ListPointer *lp[num_terms];
+    size_t order[num_terms]; // positions in lp by increasing maximum score
+    double upper_bounds[num_terms]; // sum of the maximums up to each list
+    int term_freqs[num_terms];      // frequencies (or impacts) of the
+                                    // current document, 0 if not in a list
+    double term_scores[num_terms];  // and the scores they give
+    float weights[num_terms]; // the per-term BM25 constants, as in d_DAAT
+    size_t i;
+    for (i = 0; i < num_terms; i++) {
+        lp[i] = open_list(&postings_lists[i]);
+        next_or_end(lp[i], 0, &postings_lists[i]);
+        order[i] = i;
+        weights[i] = term_weight(postings_lists[i].num_entries);
+    }
+    maxscore_lists = postings_lists;
+    qsort(order, num_terms, sizeof(size_t), compare_max_scores);
     for (i = 0; i < num_terms; i++) {
-        close_list(lp[i]);
+        upper_bounds[i] =
+            postings_lists[order[i]].max_score * (1 + BOUND_SLACK) +
+            (i > 0 ? upper_bounds[i - 1] : 0);
+    }
+
+    size_t non_essential = 0; // lists order[0..non_essential) are
+                              // non-essential
+    while (non_essential < num_terms) {
+        // the next document is the lowest docID of the essential lists
+        int did = INT_MAX;
+        for (i = non_essential; i < num_terms; i++) {
+            if (lp[order[i]]->curr_doc_id < did) {
+                did = lp[order[i]]->curr_doc_id;
+            }
+        }
+        if (did == INT_MAX) {
+            break;
+        }
+
+        // score the essential lists on it and move them along
+        double score = 0;
+        memset(term_freqs, 0, sizeof(term_freqs));
+        for (i = non_essential; i < num_terms; i++) {
+            size_t t = order[i];
+            if (lp[t]->curr_doc_id == did) {
+                term_freqs[t] = get_freq(lp[t], &postings_lists[t]);
+                term_scores[t] =
+                    impact_scale ? term_freqs[t] * impact_scale
+                                 : term_score(weights[t], term_freqs[t], did);
+                score += term_scores[t];
+                next_or_end(lp[t], did + 1, &postings_lists[t]);
+            }
+        }
+
+        // then probe the non-essential lists while the document can still
+        // beat the heap
+        double threshold =
+            top_k->size < top_k->capacity ? -1 : top_k->nodes[0].score;
+        int pruned = 0;
+        for (i = non_essential; i-- > 0;) {
+            if (score + upper_bounds[i] <= threshold) {
+                pruned = 1;
+                break;
+            }
+            size_t t = order[i];
+            if (next_or_end(lp[t], did, &postings_lists[t]) == did) {
+                term_freqs[t] = get_freq(lp[t], &postings_lists[t]);
+                term_scores[t] =
+                    impact_scale ? term_freqs[t] * impact_scale
+                                 : term_score(weights[t], term_freqs[t], did);
+                score += term_scores[t];
+            }
+        }
+        if (pruned) {
+            continue;
+        }
+
+        // sum the document's score in query order, like d_DAAT
+        score = 0;
+        int impact = 0;
+        for (i = 0; i < num_terms; i++) {
+            if (term_freqs[i] == 0) {
+                continue;
+            }
+            if (impact_scale) {
+                impact += term_freqs[i];
+            } else {
+                score += term_scores[i];
+            }
+        }
+        if (impact_scale) {
+            score = impact * impact_scale;
+        }
+        insert(top_k, did, score);
+
+        // a higher threshold can make more lists non-essential
+        if (top_k->size == top_k->capacity) {
+            while (non_essential < num_terms &&
+                   upper_bounds[non_essential] <= top_k->nodes[0].score) {
+                non_essential++;
+            }
+        }
+    }
+}
+
+// term-at-a-time evaluation for short disjunctive queries: each postings
+// list is streamed once, in docID order, into a dense accumulator with one
+// score per docID, and the top k are taken from the accumulators at the end.
+// the accumulators are split into blocks of ACC_BLOCK_SIZE docIDs, each with
+// the epoch (query) that last wrote it and its largest score. a block is
+// cleared the first time a query touches it, so nothing is reset between
+// queries, and the top k are taken from the blocks by decreasing largest
+// score until the next block cannot enter the heap. impact indexes
+// accumulate the integer impacts, which floats hold exactly, and scale the
+// sums at the end
+typedef struct {
+    float *scores;        // one per docID
+    unsigned int *epochs; // epoch each block was last written in
+    float *block_max;     // largest score of each block in its epoch
+    size_t *touched;      // blocks written in the current epoch
+    size_t num_touched;
+    size_t num_blocks;
+    unsigned int epoch;
+} Accumulators;
+
+Accumulators accumulators;
+
+// allocate the accumulators for every docID of the collection, on the first
+// term-at-a-time query
+void init_accumulators(Accumulators *acc) {
+    acc->num_blocks = (doc_table_size + ACC_BLOCK_SIZE - 1) / ACC_BLOCK_SIZE;
+    size_t n = acc->num_blocks ? acc->num_blocks : 1;
+    acc->scores = malloc(n * ACC_BLOCK_SIZE * sizeof(float));
+    acc->epochs = calloc(n, sizeof(unsigned int));
+    acc->block_max = malloc(n * sizeof(float));
+    acc->touched = malloc(n * sizeof(size_t));
+    if (!acc->scores || !acc->epochs || !acc->block_max || !acc->touched) {
+        perror("Error allocating memory for accumulators");
+        exit(EXIT_FAILURE);
+    }
+    acc->epoch = 0;
+}
+
+// start a new query, the blocks of the previous ones become stale
+void next_epoch(Accumulators *acc) {
+    if (!acc->scores) {
+        init_accumulators(acc);
+    }
+    acc->epoch++;
+    if (acc->epoch == 0) {
+        // wrapped around, forget every block's epoch once
+        memset(acc->epochs, 0, acc->num_blocks * sizeof(unsigned int));
+        acc->epoch = 1;
+    }
+    acc->num_touched = 0;
+}
+
+// adds the scores of n postings to their documents' accumulators
+void accumulate(Accumulators *acc, const int *doc_ids, const float *scores,
+                size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        size_t b = (size_t)doc_ids[i] / ACC_BLOCK_SIZE;
+        if (acc->epochs[b] != acc->epoch) {
+            memset(acc->scores + b * ACC_BLOCK_SIZE, 0,
+                   ACC_BLOCK_SIZE * sizeof(float));
+            acc->epochs[b] = acc->epoch;
+            acc->block_max[b] = 0;
+            acc->touched[acc->num_touched++] = b;
+        }
+        float score = acc->scores[doc_ids[i]] + scores[i];
+        acc->scores[doc_ids[i]] = score;
+        if (score > acc->block_max[b]) {
+            acc->block_max[b] = score;
+        }
+    }
+}
+
+// scores n postings of a term and adds them to the accumulators, a
+// SCORE_BATCH at a time
+void accumulate_postings(Accumulators *acc, float weight, const int *doc_ids,
+                         const int *freqs, size_t n, float *scores) {
+    for (size_t i = 0; i < n; i += SCORE_BATCH) {
+        size_t m = n - i < SCORE_BATCH ? n - i : SCORE_BATCH;
+        if (impact_scale) {
+            for (size_t j = 0; j < m; j++) {
+                scores[j] = freqs[i + j];
+            }
+        } else {
+            score_postings(weight, doc_ids + i, freqs + i, m, scores);
+        }
+        accumulate(acc, doc_ids + i, scores, m);
+    }
+}
+
+int compare_block_max(const void *a, const void *b) {
+    float x = accumulators.block_max[*(const size_t *)a];
+    float y = accumulators.block_max[*(const size_t *)b];
+    return (x < y) - (x > y);
+}
+
+// inserts the documents of the current epoch into the heap, from the blocks
+// with the largest scores first
+void accumulators_top_k(Accumulators *acc, MinHeap *top_k) {
+    qsort(acc->touched, acc->num_touched, sizeof(size_t), compare_block_max);
+    for (size_t i = 0; i < acc->num_touched; i++) {
+        size_t b = acc->touched[i];
+        double block_max = acc->block_max[b];
+        if (impact_scale) {
+            block_max *= impact_scale;
+        }
+        if (top_k->size == top_k->capacity &&
+            block_max <= top_k->nodes[0].score) {
+            break; // no later block has a larger score
+        }
+        const float *block = acc->scores + b * ACC_BLOCK_SIZE;
+        for (size_t d = 0; d < ACC_BLOCK_SIZE; d++) {
+            if (block[d] > 0) {
+                insert(top_k, b * ACC_BLOCK_SIZE + d,
+                       impact_scale ? block[d] * impact_scale : block[d]);
+            }
+        }
+    }
+}
+
+void TAAT(PostingsList *postings_lists, size_t num_terms, MinHeap *top_k) {
+    Accumulators *acc = &accumulators;
+    next_epoch(acc);
+    int *doc_ids = arena_alloc(&query_arena, SCORE_BATCH * sizeof(int));
+    int *freqs = arena_alloc(&query_arena, SCORE_BATCH * sizeof(int));
+    float *scores = arena_alloc(&query_arena, SCORE_BATCH * sizeof(float));
+
+    for (size_t t = 0; t < num_terms; t++) {
+        PostingsList *postings_list = &postings_lists[t];
+        ListPointer *lp = open_list(postings_list);
+        float weight = term_weight(postings_list->num_entries);
+        int did = nextGEQ(lp, 0, postings_list);
+        if (postings_list->containers) {
+            // a bitmap term has no decoded docIDs, its postings are
+            // collected one at a time
+            size_t n = 0;
+            while (1) {
+                doc_ids[n] = did;
+                freqs[n++] = get_freq(lp, postings_list);
+                int last = did >= postings_list->last_did;
+                if (n == SCORE_BATCH || last) {
+                    accumulate_postings(acc, weight, doc_ids, freqs, n,
+                                        scores);
+                    n = 0;
+                }
+                if (last) {
+                    break;
+                }
+                did = nextGEQ(lp, did + 1, postings_list);
+            }
+            continue;
+        }
+        while (1) {
+            // the rest of the decoded block (or sub-block) the cursor is in
+            if (lp->pack) {
+                decode_cursor_pack(lp);
+            }
+            get_freq(lp, postings_list); // decodes its frequencies
+            size_t n = lp->curr_size - lp->curr_posting;
+            const int *run = lp->curr_d_block_uncompressed + lp->curr_posting;
+            accumulate_postings(acc, weight, run,
+                                lp->curr_f_block_uncompressed +
+                                    lp->curr_posting,
+                                n, scores);
+            int last = run[n - 1];
+            if (last >= postings_list->last_did) {
+                break;
+            }
+            did = nextGEQ(lp, last + 1, postings_list);
+        }
+    }
+    accumulators_top_k(acc, top_k);
+}
+
+// wall clock time in seconds, for the microbenchmarks and the
+// score-at-a-time time budget
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// map the impact segments of gen -s, needs the lexicon to be loaded first.
+// returns 0 if the file does not exist
+int map_impacts(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("Error reading impacts size");
+        exit(EXIT_FAILURE);
+    }
+    size_t size = st.st_size;
+    if (size < sizeof(ImpactsHeader)) {
+        fprintf(stderr, "Impacts %s are truncated\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Error mapping impacts");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    const ImpactsHeader *header = map;
+    if (memcmp(header->magic, IMPACTS_MAGIC, sizeof(header->magic)) != 0 ||
+        header->num_terms != num_lexicon_records ||
+        size != header->directory_offset +
+                    header->num_terms * sizeof(size_t)) {
+        fprintf(stderr, "Impacts %s are corrupt or from another index\n",
+                filename);
+        exit(EXIT_FAILURE);
+    }
+    impacts_map = map;
+    impacts_size = size;
+    impact_directory = (const size_t *)(impacts_map + header->directory_offset);
+    return 1;
+}
+
+// one impact segment of a query term, for the score-at-a-time merge
+typedef struct {
+    unsigned int impact;
+    unsigned int count;
+    const unsigned char *data; // varbyte docID gaps
+} SegmentCursor;
+
+int compare_segment_impacts(const void *a, const void *b) {
+    unsigned int x = ((const SegmentCursor *)a)->impact;
+    unsigned int y = ((const SegmentCursor *)b)->impact;
+    return (x < y) - (x > y); // decreasing impact
+}
+
+// score-at-a-time evaluation (Anh and Moffat, JASS) over the impact segments
+// of gen -s. the segments of all query terms are processed by decreasing
+// impact into the term-at-a-time accumulators, so the postings that add the
+// most to the scores come first. once saat_postings_budget postings are
+// added or saat_time_budget has passed (the clock is read every SCORE_BATCH
+// postings) the rest is skipped and the top k of the accumulators so far is
+// the answer, which bounds the cost of a query full of frequent terms.
+// without a budget the scores are those of d_DAAT on the same impact index,
+// and without impacts.dat d_DAAT answers the query
+void SAAT(PostingsList *postings_lists, size_t num_terms, MinHeap *top_k) {
+    if (!impacts_map) {
+        // no impact segments to go through, evaluate every document. the
+        // hint is given once, not for every query of a batch
+        static int warned = 0;
+        if (!warned) {
+            fprintf(stderr, "The index has no impact segments, rebuild it "
+                            "with gen -s to score at a time\n");
+            warned = 1;
+        }
+        d_DAAT(postings_lists, num_terms, top_k);
+        return;
+    }
+    double start = now_seconds();
+
+    // the segments of all terms, by decreasing impact
+    size_t num_segments = 0;
+    for (size_t t = 0; t < num_terms; t++) {
+        unsigned int n;
+        memcpy(&n, impacts_map + impact_directory[postings_lists[t].term_id],
+               sizeof(unsigned int));
+        num_segments += n;
+    }
+    SegmentCursor *segments =
+        arena_alloc(&query_arena, (num_segments + 1) * sizeof(SegmentCursor));
+    size_t s = 0;
+    for (size_t t = 0; t < num_terms; t++) {
+        const unsigned char *list =
+            impacts_map + impact_directory[postings_lists[t].term_id];
+        unsigned int n;
+        memcpy(&n, list, sizeof(unsigned int));
+        const unsigned char *data =
+            list + sizeof(unsigned int) + n * sizeof(ImpactSegment);
+        for (unsigned int i = 0; i < n; i++) {
+            ImpactSegment segment;
+            memcpy(&segment,
+                   list + sizeof(unsigned int) + i * sizeof(ImpactSegment),
+                   sizeof(ImpactSegment));
+            segments[s].impact = segment.impact;
+            segments[s].count = segment.count;
+            segments[s].data = data;
+            data += segment.size;
+            s++;
+        }
+    }
+    qsort(segments, num_segments, sizeof(SegmentCursor),
+          compare_segment_impacts);
+
+    Accumulators *acc = &accumulators;
+    next_epoch(acc);
+    int *doc_ids = arena_alloc(&query_arena, SCORE_BATCH * sizeof(int));
+    float *impacts = arena_alloc(&query_arena, SCORE_BATCH * sizeof(float));
+    size_t processed = 0;
+    int out_of_time = 0;
+    for (s = 0; s < num_segments && !out_of_time; s++) {
+        if (saat_postings_budget && processed >= saat_postings_budget) {
+            break;
+        }
+        size_t count = segments[s].count;
+        if (saat_postings_budget &&
+            count > saat_postings_budget - processed) {
+            count = saat_postings_budget - processed;
+        }
+        const unsigned char *data = segments[s].data;
+        int doc_id = 0;
+        size_t i = 0;
+        while (i < count) {
+            // the clock is read every SCORE_BATCH postings, so a long
+            // segment of a frequent term is cut short too
+            if (saat_time_budget &&
+                now_seconds() - start >= saat_time_budget) {
+                out_of_time = 1;
+                break;
+            }
+            size_t m = count - i < SCORE_BATCH ? count - i : SCORE_BATCH;
+            for (size_t j = 0; j < m; j++) {
+                int gap;
+                data += varbyte_read(data, &gap);
+                doc_id += gap;
+                doc_ids[j] = doc_id;
+                impacts[j] = segments[s].impact;
+            }
+            accumulate(acc, doc_ids, impacts, m);
+            i += m;
+        }
+        processed += i;
+    }
+    accumulators_top_k(acc, top_k);
+}
+
+void free_lexicon() {
+    if (lexicon_map) {
+        munmap(lexicon_map, lexicon_map_size);
+    } else {
+        free(lexicon_records);
+        free((unsigned int *)lexicon_dict_records);
+        free((unsigned int *)lexicon_dict_offsets);
+        free((unsigned char *)lexicon_dict);
+        free(lexicon_last);
+    }
+}
+
+// checks the index format read from a lexicon header
+void check_index_format() {
+    if (index_version < INDEX_VERSION_RAW ||
+        index_version > INDEX_VERSION_INLINE) {
+        fprintf(stderr, "Unsupported index version %d\n", index_version);
+        exit(EXIT_FAILURE);
+    }
+    if (index_codec != CODEC_VARBYTE && index_codec != CODEC_BP128 &&
+        index_codec != CODEC_STREAMVBYTE && index_codec != CODEC_ELIAS_FANO) {
+        fprintf(stderr, "Unsupported index codec %d\n", index_codec);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// map the binary lexicon written for version 3 and up. the records and terms
+// are used in place, so nothing is parsed or allocated and the pages are
+// shared with the page cache. returns 0 if the file does not exist
+int map_lexicon(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("Error reading binary lexicon size");
+        exit(EXIT_FAILURE);
+    }
+    lexicon_map_size = st.st_size;
+    if (lexicon_map_size < sizeof(LexiconHeader)) {
+        fprintf(stderr, "Binary lexicon %s is truncated\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    lexicon_map = mmap(NULL, lexicon_map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (lexicon_map == MAP_FAILED) {
+        perror("Error mapping binary lexicon");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    const LexiconHeader *header = lexicon_map;
+    if (memcmp(header->magic, LEXICON_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "Binary lexicon %s has an old format, rebuild the "
+                        "index\n",
+                filename);
+        exit(EXIT_FAILURE);
+    }
+    size_t num_dict_blocks =
+        (header->num_terms + DICT_BLOCK_SIZE - 1) / DICT_BLOCK_SIZE;
+    if (header->num_buckets == 0 ||
+        lexicon_map_size !=
+            sizeof(LexiconHeader) + header->num_terms * sizeof(LexiconRecord) +
+                (header->num_buckets + header->num_terms + num_dict_blocks) *
+                    sizeof(unsigned int) +
+                header->dict_size) {
+        fprintf(stderr, "Binary lexicon %s is corrupt\n", filename);
+        exit(EXIT_FAILURE);
     }
+    index_version = header->version;
+    index_codec = header->codec;
+    impact_scale = header->impact_scale;
+    check_index_format();
+    num_lexicon_records = header->num_terms;
+    lexicon_num_buckets = header->num_buckets;
+    lexicon_records = (LexiconRecord *)(header + 1);
+    lexicon_seeds =
+        (const unsigned int *)(lexicon_records + num_lexicon_records);
+    lexicon_dict_records = lexicon_seeds + lexicon_num_buckets;
+    lexicon_dict_offsets = lexicon_dict_records + num_lexicon_records;
+    lexicon_dict =
+        (const unsigned char *)(lexicon_dict_offsets + num_dict_blocks);
+    return 1;
 }
 
-void free_lexicon() {
-    LexiconEntry *current_entry, *tmp;
+// a term of a text lexicon and the record it belongs to, sorted to build the
+// dictionary
+typedef struct {
+    const char *term;
+    size_t record;
+} TermRef;
+
+// orders term references by term
+int compare_term_refs(const void *a, const void *b) {
+    return strcmp(((const TermRef *)a)->term, ((const TermRef *)b)->term);
+}
 
-    HASH_ITER(hh, lexicon_table, current_entry, tmp) {
-        HASH_DEL(lexicon_table,
-                 current_entry);   // Delete the entry from the hash map
-        free(current_entry->last); // Free the dynamically allocated array
-        free(current_entry);       // Free the entry itself
+// this function front codes the sorted terms into blocks of DICT_BLOCK_SIZE
+// for a text lexicon. it is a copy of the generator's front_code, which
+// defines the layout of the dictionary in lexicon.bin, and has to write the
+// same bytes: dict_read decodes both. offsets gets the start of each block
+// and size the total size of the blocks
+unsigned char *front_code(const char **terms, size_t n, unsigned int *offsets,
+                          size_t *size) {
+    size_t capacity = 1;
+    for (size_t i = 0; i < n; i++) {
+        capacity += strlen(terms[i]) + 2;
+    }
+    unsigned char *dict = malloc(capacity);
+    if (!dict) {
+        perror("Error allocating memory for the term dictionary");
+        exit(EXIT_FAILURE);
+    }
+    size_t pos = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t lcp = 0;
+        if (i % DICT_BLOCK_SIZE == 0) {
+            offsets[i / DICT_BLOCK_SIZE] = pos;
+        } else {
+            while (terms[i][lcp] && terms[i][lcp] == terms[i - 1][lcp]) {
+                lcp++;
+            }
+            dict[pos++] = lcp; // terms are shorter than MAX_WORD_SIZE
+        }
+        size_t length = strlen(terms[i] + lcp) + 1;
+        memcpy(dict + pos, terms[i] + lcp, length);
+        pos += length;
     }
+    *size = pos;
+    return dict;
 }
 
-// load lexicon into memory for easy search of term metadata
+// load a text lexicon (version 1 and 2 indexes) into the same record layout
+// as the binary one, so the lookups do not care which one was loaded
 void load_lexicon(const char *filename) {
     FILE *file = fopen(filename, "r");
     if (!file) {
@@ -732,49 +3421,128 @@ void load_lexicon(const char *filename) {
     size_t start_d_offset, start_f_offset, last_f_offset, last_d_offset,
         num_blocks;
 
+    // header lines start with '#', e.g. "#version 2". lexicons written
+    // before the header existed have none and use the raw docID format
+    int c;
+    while ((c = fgetc(file)) == '#') {
+        char key[MAX_WORD_SIZE];
+        int value;
+        if (fscanf(file, "%s %d\n", key, &value) != 2) {
+            fprintf(stderr, "Error reading lexicon header\n");
+            exit(EXIT_FAILURE);
+        }
+        if (!strcmp(key, "version")) {
+            index_version = value;
+        } else if (!strcmp(key, "codec")) {
+            index_codec = value;
+        }
+    }
+    ungetc(c, file);
+    check_index_format();
+    if (index_version >= INDEX_VERSION_SKIPS) {
+        fprintf(stderr, "Version %d indexes need lexicon.bin\n",
+                index_version);
+        exit(EXIT_FAILURE);
+    }
+
+    // the records, terms and last docIDs grow in three arrays, instead of
+    // one allocation per term
+    size_t records_capacity = 1024, pool_size = 0, pool_capacity = 65536,
+           num_last = 0, last_capacity = 65536;
+    char *pool = malloc(pool_capacity);
+    lexicon_records = malloc(sizeof(LexiconRecord) * records_capacity);
+    lexicon_last = malloc(sizeof(int) * last_capacity);
+    if (!pool || !lexicon_records || !lexicon_last) {
+        perror("Error allocating memory for lexicon");
+        exit(EXIT_FAILURE);
+    }
+
     while (fscanf(file, "%s %d %d %zu %zu %d %zu %zu %d %zu", term,
                   &num_entries, &start_d_block, &start_d_offset,
                   &start_f_offset, &last_d_block, &last_d_offset,
                   &last_f_offset, &last_did, &num_blocks) == 10) {
-        LexiconEntry *entry = (LexiconEntry *)malloc(sizeof(LexiconEntry));
-        if (!entry) {
-            perror("Error allocating memory for lexicon entry");
+        size_t term_length = strlen(term) + 1;
+        num_blocks++;
+        if (num_lexicon_records == records_capacity) {
+            records_capacity *= 2;
+            lexicon_records = realloc(lexicon_records, sizeof(LexiconRecord) *
+                                                           records_capacity);
+        }
+        while (pool_size + term_length > pool_capacity) {
+            pool_capacity *= 2;
+            pool = realloc(pool, pool_capacity);
+        }
+        while (num_last + num_blocks > last_capacity) {
+            last_capacity *= 2;
+            lexicon_last = realloc(lexicon_last, sizeof(int) * last_capacity);
+        }
+        if (!pool || !lexicon_records || !lexicon_last) {
+            perror("Error reallocating memory for lexicon");
             exit(EXIT_FAILURE);
         }
-        strcpy(entry->term, term);
+
+        LexiconRecord *entry = &lexicon_records[num_lexicon_records++];
+        entry->skip_offset = num_last;
+        entry->term_id = pool_size; // the term's offset in pool until the
+                                    // dictionary is built
         entry->num_entries = num_entries;
         entry->start_d_block = start_d_block;
+        entry->last_d_block = last_d_block;
         entry->start_d_offset = start_d_offset;
         entry->start_f_offset = start_f_offset;
-        entry->last_d_block = last_d_block;
         entry->last_d_offset = last_d_offset;
         entry->last_f_offset = last_f_offset;
         entry->last_did = last_did;
-        entry->num_blocks = num_blocks + 1;
-
-        // Read the variable part (last array)
-        entry->last = (int *)malloc(sizeof(int) * entry->num_blocks);
-        if (!entry->last) {
-            perror("Error allocating memory for last array");
-            free(entry);
-            exit(EXIT_FAILURE);
-        }
+        entry->num_blocks = num_blocks;
+        entry->max_score = 0; // text lexicons have no score bounds
+        entry->num_containers = 0;
+        memcpy(pool + pool_size, term, term_length);
+        pool_size += term_length;
 
         // Read the variable part (last array)
-        for (size_t i = 0; i < entry->num_blocks; i++) {
-            if (fscanf(file, "%d", &entry->last[i]) != 1) {
+        for (size_t i = 0; i < num_blocks; i++) {
+            if (fscanf(file, "%d", &lexicon_last[num_last++]) != 1) {
                 perror("Error reading last array");
-                free(entry->last);
-                free(entry);
                 exit(EXIT_FAILURE);
             }
         }
-
-        // Add the entry to the hash table
-        HASH_ADD_STR(lexicon_table, term, entry);
     }
-
     fclose(file);
+
+    // the postings were sorted with sort --version-sort, the dictionary
+    // needs strcmp order. the records are put in dictionary order too
+    size_t n = num_lexicon_records;
+    size_t num_dict_blocks = (n + DICT_BLOCK_SIZE - 1) / DICT_BLOCK_SIZE;
+    TermRef *refs = malloc(sizeof(TermRef) * (n ? n : 1));
+    const char **sorted_terms = malloc(sizeof(char *) * (n ? n : 1));
+    LexiconRecord *sorted = malloc(sizeof(LexiconRecord) * (n ? n : 1));
+    unsigned int *dict_records = malloc(sizeof(unsigned int) * (n ? n : 1));
+    unsigned int *dict_offsets =
+        malloc(sizeof(unsigned int) * (num_dict_blocks ? num_dict_blocks : 1));
+    if (!refs || !sorted_terms || !sorted || !dict_records || !dict_offsets) {
+        perror("Error allocating memory for the term dictionary");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < n; i++) {
+        refs[i].term = pool + lexicon_records[i].term_id;
+        refs[i].record = i;
+    }
+    qsort(refs, n, sizeof(TermRef), compare_term_refs);
+    for (size_t i = 0; i < n; i++) {
+        sorted_terms[i] = refs[i].term;
+        sorted[i] = lexicon_records[refs[i].record];
+        sorted[i].term_id = i;
+        dict_records[i] = i;
+    }
+    size_t dict_size;
+    lexicon_dict = front_code(sorted_terms, n, dict_offsets, &dict_size);
+    lexicon_dict_records = dict_records;
+    lexicon_dict_offsets = dict_offsets;
+    free(lexicon_records);
+    lexicon_records = sorted;
+    free(refs);
+    free(sorted_terms);
+    free(pool);
 }
 
 // Function to parse and clean a query term
@@ -818,21 +3586,56 @@ void return_top_k(MinHeap *heap, FILE *results, int query_id) {
     fprintf(results, "\n");
 }
 
+// splits a query into cleaned terms, writing at most MAX_TERMS of them to
+// terms. in disjunctive mode a term ending in '*' is a prefix query and
+// expands to up to MAX_PREFIX_TERMS dictionary terms, the ones in the most
+// documents, which keeps the number of cursors of a wildcard bounded.
+// block-max WAND and MaxScore are disjunctive too and expand them the same
+// way.
+// returns the number of terms
+size_t parse_query(char *query, char **terms, int search_mode) {
+    const char *delimiters =
+        " \t\n\r\f\v!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+    size_t num_terms = 0;
+    char *p = query;
+    while (num_terms < MAX_TERMS) {
+        p += strspn(p, delimiters);
+        if (*p == '\0') {
+            break;
+        }
+        char *term = p;
+        p += strcspn(p, delimiters);
+        int prefix = *p == '*';
+        if (*p != '\0') {
+            *p++ = '\0';
+        }
+        parse_term(term);
+        if (strlen(term) == 0) {
+            continue;
+        }
+        if (prefix && search_mode != CONJUNCTIVE) {
+            size_t max_terms = MAX_TERMS - num_terms < MAX_PREFIX_TERMS
+                                   ? MAX_TERMS - num_terms
+                                   : MAX_PREFIX_TERMS;
+            size_t n = expand_prefix(term, terms + num_terms, max_terms);
+            printf("Prefix '%s*' expanded to %zu terms\n", term, n);
+            num_terms += n;
+        } else {
+            terms[num_terms++] = arena_strdup(&query_arena, term);
+        }
+    }
+    return num_terms;
+}
+
 // processes a single query for the batch processing and writes the results to
 // the results file
 int single_query(Query *query, size_t heap_size, int search_mode, FILE *index,
                  FILE *results) {
+    // release everything the previous query allocated
+    arena_reset(&query_arena);
+
     char *terms[MAX_TERMS];
-    size_t num_terms = 0;
-    char *term =
-        strtok(query->query, " \t\n\r\f\v!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~");
-    while (term != NULL && num_terms < MAX_TERMS) {
-        parse_term(term);
-        if (strlen(term) > 0) {
-            terms[num_terms++] = strdup(term);
-        }
-        term = strtok(NULL, " \t\n\r\f\v!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~");
-    }
+    size_t num_terms = parse_query(query->query, terms, search_mode);
 
     // Retrieve postings lists for all terms in query
     PostingsList postings_lists[num_terms];
@@ -848,38 +3651,763 @@ int single_query(Query *query, size_t heap_size, int search_mode, FILE *index,
     printf("Performing search on %zu valid terms...\n", valid_terms);
     if (search_mode == CONJUNCTIVE) {
         c_DAAT(postings_lists, valid_terms, &top_k);
+    } else if (search_mode == BLOCK_MAX_WAND) {
+        bmw_DAAT(postings_lists, valid_terms, &top_k);
+    } else if (search_mode == MAXSCORE) {
+        maxscore_DAAT(postings_lists, valid_terms, &top_k);
+    } else if (search_mode == TERM_AT_A_TIME) {
+        TAAT(postings_lists, valid_terms, &top_k);
+    } else if (search_mode == SCORE_AT_A_TIME) {
+        SAAT(postings_lists, valid_terms, &top_k);
     } else {
         d_DAAT(postings_lists, valid_terms, &top_k);
     }
 
     // return top 10 results
     return_top_k(&top_k, results, query->id);
-    free_min_heap(&top_k);
+    return 0;
+}
+
+// the decoder decompress_block used before the bulk paths, one checked
+// varbyte_decode call per integer and the docIDs read until the block's last
+// one, kept for the decode benchmark. returns the number of postings decoded
+size_t decompress_block_per_integer(ListPointer *lp,
+                                    PostingsList *postings_list) {
+    unsigned char *input = (unsigned char *)d_block_data(lp, postings_list);
+    int last_doc_id_in_block = postings_list->skips[lp->curr_block].max_did;
+    int prev_doc_id = 0;
+    size_t i = 0;
+    while (1) {
+        size_t bytes_read =
+            varbyte_decode(input, lp->curr_d_block_uncompressed + i);
+        if (bytes_read == 0) {
+            return i;
+        }
+        input += bytes_read;
+        if (index_version >= INDEX_VERSION_DGAP) {
+            lp->curr_d_block_uncompressed[i] += prev_doc_id;
+            prev_doc_id = lp->curr_d_block_uncompressed[i];
+        }
+        if (lp->curr_d_block_uncompressed[i++] == last_doc_id_in_block) {
+            break;
+        }
+    }
+    input = (unsigned char *)f_block_data(lp, postings_list);
+    for (size_t j = 0; j < i; j++) {
+        size_t bytes_read =
+            varbyte_decode(input, lp->curr_f_block_uncompressed + j);
+        if (bytes_read == 0) {
+            return i;
+        }
+        input += bytes_read;
+    }
+    return i;
+}
 
-    // Free allocated memory for terms and postings lists
-    for (size_t i = 0; i < valid_terms; i++) {
-        free(terms[i]);
-        free(postings_lists[i].compressed_d_list);
-        free(postings_lists[i].compressed_f_list);
+// microbenchmark for the block decoders, run with ./proc -m decode. the
+// blocks of the longest posting lists in final_index.dat are decoded as the
+// generator wrote them: with the index's own codec through decompress_block
+// and, on a varbyte index, also with the old per-integer loop. to compare
+// codecs, build the index with each gen -c and run the benchmark on each
+void bench_decode(FILE *index, size_t num_lists) {
+    // pick the longest lists from the lexicon
+    LexiconRecord *longest[num_lists];
+    size_t found = 0;
+    for (size_t r = 0; r < num_lexicon_records; r++) {
+        LexiconRecord *entry = &lexicon_records[r];
+        if (entry->num_containers || entry->num_blocks == 0) {
+            continue; // bitmap and inline terms have no docID blocks
+        }
+        size_t k = found < num_lists ? found++ : num_lists;
+        if (k == num_lists &&
+            entry->num_entries <= longest[num_lists - 1]->num_entries) {
+            continue;
+        }
+        if (k == num_lists) {
+            k--;
+        }
+        while (k > 0 && longest[k - 1]->num_entries < entry->num_entries) {
+            longest[k] = longest[k - 1];
+            k--;
+        }
+        longest[k] = entry;
+    }
+    char *terms[num_lists];
+    char term_buffers[num_lists][MAX_WORD_SIZE];
+    for (size_t t = 0; t < found; t++) {
+        dict_term(longest[t]->term_id, term_buffers[t]);
+        terms[t] = term_buffers[t];
+    }
+    PostingsList lists[num_lists];
+    lazy_freqs = 0; // whole blocks are decoded below
+    fetch_blocks = 0;
+    size_t num_terms = retrieve_postings_lists(terms, found, lists, index);
+
+    size_t total_blocks = 0, n = 0;
+    for (size_t t = 0; t < num_terms; t++) {
+        total_blocks += lists[t].num_blocks;
+        n += lists[t].num_entries;
+    }
+    printf("Decode benchmark: %zu lists, %zu blocks, %zu postings\n",
+           num_terms, total_blocks, n);
+    if (n == 0) {
+        return;
+    }
+    int *output = malloc(2 * MAX_BLOCK_POSTINGS * sizeof(int));
+    if (!output) {
+        perror("Error allocating memory for decode benchmark");
+        exit(EXIT_FAILURE);
+    }
+    ListPointer *cursors[num_lists];
+    for (size_t t = 0; t < num_terms; t++) {
+        cursors[t] = open_list(&lists[t]);
+        cursors[t]->curr_d_block_uncompressed = output;
+        cursors[t]->curr_f_block_uncompressed = output + MAX_BLOCK_POSTINGS;
+    }
+
+    size_t rounds = 1 + 200000000 / (2 * n + 1);
+    long long checksum;
+    double start, seconds;
+    double baseline = 0;
+    const char *codec_names[] = {"index blocks, varbyte", "index blocks, bp128",
+                                 "index blocks, streamvbyte",
+                                 "index blocks, eliasfano"};
+
+    // 1. old decoder, one checked varbyte_decode call per integer
+    if (index_codec == CODEC_VARBYTE) {
+        checksum = 0;
+        start = now_seconds();
+        for (size_t r = 0; r < rounds; r++) {
+            for (size_t t = 0; t < num_terms; t++) {
+                ListPointer *lp = cursors[t];
+                for (lp->curr_block = 0; lp->curr_block < lists[t].num_blocks;
+                     lp->curr_block++) {
+                    size_t count = decompress_block_per_integer(lp, &lists[t]);
+                    checksum += output[count - 1];
+                }
+            }
+        }
+        baseline = now_seconds() - start;
+        printf("%-32s %8.3f ns/int %10.1f M ints/s  (checksum %lld)\n",
+               "varbyte, per-integer decode",
+               baseline * 1e9 / (2.0 * n * rounds),
+               2.0 * n * rounds / baseline / 1e6, checksum);
+    }
+
+    // 2. the index's own codec through decompress_block
+    checksum = 0;
+    start = now_seconds();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t t = 0; t < num_terms; t++) {
+            ListPointer *lp = cursors[t];
+            for (lp->curr_block = 0; lp->curr_block < lists[t].num_blocks;
+                 lp->curr_block++) {
+                size_t count = decompress_block(lp, &lists[t]);
+                checksum += output[count - 1];
+            }
+        }
+    }
+    seconds = now_seconds() - start;
+    printf("%-32s %8.3f ns/int %10.1f M ints/s  (checksum %lld",
+           codec_names[index_codec], seconds * 1e9 / (2.0 * n * rounds),
+           2.0 * n * rounds / seconds / 1e6, checksum);
+    if (baseline > 0) {
+        printf(", %.2fx", baseline / seconds);
+    }
+    printf(")\n");
+
+    arena_reset(&query_arena);
+    free(output);
+}
+
+// microbenchmark for the in-block docID search, run with ./proc -m seek. a
+// decoded block of synthetic docIDs is intersected with shorter lists that
+// have one docID for about every skew docIDs of the block, seeking the block
+// the way c_DAAT seeks its longer lists: with the old linear walk, and with
+// find_posting
+void bench_seek() {
+    size_t n = BLOCK_SIZE / 4; // a decoded block of small gaps
+    int *doc_ids = malloc(n * sizeof(int));
+    int *targets = malloc(n * sizeof(int));
+    if (!doc_ids || !targets) {
+        perror("Error allocating memory for seek benchmark");
+        exit(EXIT_FAILURE);
+    }
+    srand(1);
+    int doc_id = 0;
+    for (size_t i = 0; i < n; i++) {
+        doc_id += 1 + rand() % 16;
+        doc_ids[i] = doc_id;
+    }
+    printf("Seek benchmark: %zu docIDs per block\n", n);
+
+    size_t skews[] = {1, 4, 16, 64, 256, 1024};
+    for (size_t s = 0; s < sizeof(skews) / sizeof(skews[0]); s++) {
+        // the shorter list, half of its docIDs are in the block
+        size_t num_targets = 0;
+        for (size_t i = 0; i < n; i += 1 + rand() % (2 * skews[s])) {
+            targets[num_targets++] = doc_ids[i] - rand() % 2;
+        }
+        size_t rounds = 20000000 / num_targets + 1;
+
+        long long checksum = 0;
+        double start = now_seconds();
+        for (size_t r = 0; r < rounds; r++) {
+            size_t pos = 0;
+            for (size_t t = 0; t < num_targets; t++) {
+                while (doc_ids[pos] < targets[t]) {
+                    pos++;
+                }
+                checksum += pos;
+            }
+        }
+        double baseline = now_seconds() - start;
+        char label[64];
+        snprintf(label, sizeof(label), "skew 1:%zu, linear walk", skews[s]);
+        printf("%-32s %8.3f ns/seek  (checksum %lld)\n", label,
+               baseline * 1e9 / (num_targets * rounds), checksum);
+
+        checksum = 0;
+        start = now_seconds();
+        for (size_t r = 0; r < rounds; r++) {
+            size_t pos = 0;
+            for (size_t t = 0; t < num_targets; t++) {
+                pos = find_posting(doc_ids, pos, n, targets[t]);
+                checksum += pos;
+            }
+        }
+        double seconds = now_seconds() - start;
+        snprintf(label, sizeof(label), "skew 1:%zu, find_posting", skews[s]);
+        printf("%-32s %8.3f ns/seek  (checksum %lld, %.2fx)\n", label,
+               seconds * 1e9 / (num_targets * rounds), checksum,
+               baseline / seconds);
+    }
+    free(doc_ids);
+    free(targets);
+}
+
+int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// microbenchmark for BM25 scoring, run with ./proc -m score. postings of
+// random documents of the collection, in docID order and with small
+// frequencies, are scored one at a time with get_score, then with the
+// per-term constants (term_score), then all at once with score_postings. the
+// largest difference from get_score is reported too
+void bench_score() {
+    size_t size = use_norms ? norms_size : doc_table_size;
+    if (size > doc_table_size) {
+        size = doc_table_size;
+    }
+    size_t num_docs = 0;
+    int *docs = malloc((size ? size : 1) * sizeof(int));
+    size_t n = SCORE_BATCH * 64;
+    int *doc_ids = malloc(n * sizeof(int));
+    int *freqs = malloc(n * sizeof(int));
+    float *scores = malloc(n * sizeof(float));
+    if (!docs || !doc_ids || !freqs || !scores) {
+        perror("Error allocating memory for score benchmark");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t d = 0; d < size; d++) {
+        if (doc_table[d] > 0) {
+            docs[num_docs++] = d;
+        }
+    }
+    if (num_docs == 0) {
+        printf("No documents to score\n");
+        exit(EXIT_FAILURE);
+    }
+    srand(1);
+    for (size_t i = 0; i < n; i++) {
+        doc_ids[i] = docs[rand() % num_docs];
+        freqs[i] = rand() % 8 ? 1 + rand() % 3 : 1 + rand() % 20;
+    }
+    qsort(doc_ids, n, sizeof(int), compare_ints);
+    int num_entries = num_documents / 10 + 1;
+    float weight = term_weight(num_entries);
+    size_t rounds = 100000000 / n + 1;
+    printf("Score benchmark: %zu postings of %zu documents%s\n", n, num_docs,
+           use_norms ? ", quantized norms" : "");
+
+    double checksum = 0;
+    double start = now_seconds();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < n; i++) {
+            checksum += get_score(freqs[i], doc_ids[i], num_entries);
+        }
+    }
+    double baseline = now_seconds() - start;
+    printf("%-32s %8.3f ns/posting  (checksum %.0f)\n", "get_score",
+           baseline * 1e9 / (n * rounds), checksum);
+
+    checksum = 0;
+    start = now_seconds();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < n; i++) {
+            checksum += term_score(weight, freqs[i], doc_ids[i]);
+        }
+    }
+    double seconds = now_seconds() - start;
+    printf("%-32s %8.3f ns/posting  (checksum %.0f, %.2fx)\n", "term_score",
+           seconds * 1e9 / (n * rounds), checksum, baseline / seconds);
+
+    checksum = 0;
+    start = now_seconds();
+    for (size_t r = 0; r < rounds; r++) {
+        score_postings(weight, doc_ids, freqs, n, scores);
+    }
+    seconds = now_seconds() - start;
+    for (size_t i = 0; i < n; i++) {
+        checksum += scores[i];
+    }
+    printf("%-32s %8.3f ns/posting  (checksum %.0f, %.2fx)\n",
+           "score_postings", seconds * 1e9 / (n * rounds), checksum,
+           baseline / seconds);
+
+    double max_error = 0;
+    for (size_t i = 0; i < n; i++) {
+        double error =
+            fabs(scores[i] - get_score(freqs[i], doc_ids[i], num_entries));
+        if (error > max_error) {
+            max_error = error;
+        }
+    }
+    printf("largest difference from get_score: %g\n", max_error);
+    free(docs);
+    free(doc_ids);
+    free(freqs);
+    free(scores);
+}
+
+// benchmark of term-at-a-time against document-at-a-time evaluation, run
+// with ./proc -m taat <query file> [k]. every query of a batch query file is
+// evaluated with d_DAAT and with TAAT on the same postings lists, rounds
+// times each, and the times are reported by number of query terms. the
+// scores of the two top k are compared too
+void bench_taat(FILE *index, const char *filename, size_t k) {
+    FILE *batch = fopen(filename, "r");
+    if (!batch) {
+        perror("Error opening batch query file");
+        exit(EXIT_FAILURE);
+    }
+    size_t rounds = 5;
+    double daat_seconds[4] = {0};
+    double taat_seconds[4] = {0};
+    size_t num_queries[4] = {0};
+    size_t mismatches = 0;
+    char *line = NULL;
+    size_t length = 0;
+    int query_id;
+    while (fscanf(batch, "%d ", &query_id) == 1 &&
+           getline(&line, &length, batch) != -1) {
+        arena_reset(&query_arena);
+        char *terms[MAX_TERMS];
+        size_t num_terms = parse_query(line, terms, DISJUNCTIVE);
+        PostingsList postings_lists[MAX_TERMS];
+        size_t valid_terms =
+            retrieve_postings_lists(terms, num_terms, postings_lists, index);
+        if (valid_terms == 0) {
+            continue;
+        }
+        size_t group = valid_terms < 4 ? valid_terms - 1 : 3;
+        MinHeap daat;
+        MinHeap taat;
+        double start = now_seconds();
+        for (size_t r = 0; r < rounds; r++) {
+            init_min_heap(&daat, k);
+            d_DAAT(postings_lists, valid_terms, &daat);
+        }
+        daat_seconds[group] += now_seconds() - start;
+        start = now_seconds();
+        for (size_t r = 0; r < rounds; r++) {
+            init_min_heap(&taat, k);
+            TAAT(postings_lists, valid_terms, &taat);
+        }
+        taat_seconds[group] += now_seconds() - start;
+        num_queries[group]++;
+
+        // the same scores in the same order, up to float rounding (documents
+        // with tied scores may differ)
+        qsort(daat.nodes, daat.size, sizeof(HeapNode), compare_scores);
+        qsort(taat.nodes, taat.size, sizeof(HeapNode), compare_scores);
+        int same = daat.size == taat.size;
+        for (size_t i = 0; same && i < daat.size; i++) {
+            double score = daat.nodes[i].score;
+            same = fabs(score - taat.nodes[i].score) <= 1e-4 * score + 1e-4;
+        }
+        mismatches += !same;
+    }
+    free(line);
+    fclose(batch);
+
+    printf("TAAT benchmark: top %zu, %zu rounds per query\n", k, rounds);
+    const char *labels[4] = {"1 term", "2 terms", "3 terms", "4+ terms"};
+    for (size_t g = 0; g < 4; g++) {
+        if (num_queries[g] == 0) {
+            continue;
+        }
+        double daat = daat_seconds[g] * 1e6 / (num_queries[g] * rounds);
+        double taat = taat_seconds[g] * 1e6 / (num_queries[g] * rounds);
+        printf("%-10s %6zu queries  d_DAAT %10.1f us  TAAT %10.1f us  "
+               "(%.2fx)\n",
+               labels[g], num_queries[g], daat, taat, daat / taat);
+    }
+    printf("queries whose top k scores differ: %zu\n", mismatches);
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// benchmark of score-at-a-time evaluation, run with ./proc -m saat <query
+// file> [k] on an index built with gen -s. every query of a batch query file
+// is evaluated with d_DAAT, then with SAAT under a range of postings budgets
+// (0 is none). reported are the mean, 99th percentile and largest time per
+// query, and the share of d_DAAT's top k that each budget still finds
+void bench_saat(FILE *index, const char *filename, size_t k) {
+    if (!impacts_map) {
+        printf("The index has no impact segments, rebuild it with gen -s\n");
+        exit(EXIT_FAILURE);
+    }
+    FILE *batch = fopen(filename, "r");
+    if (!batch) {
+        perror("Error opening batch query file");
+        exit(EXIT_FAILURE);
+    }
+    size_t budgets[] = {0, 100000, 30000, 10000, 3000};
+    size_t num_configs = 1 + sizeof(budgets) / sizeof(budgets[0]);
+    size_t capacity = 1024;
+    size_t num_queries = 0;
+    // the times of each config in an array of their own, one per query
+    double *seconds[num_configs];
+    double recall[num_configs];
+    memset(recall, 0, sizeof(recall));
+    for (size_t c = 0; c < num_configs; c++) {
+        seconds[c] = malloc(capacity * sizeof(double));
+        if (!seconds[c]) {
+            perror("Error allocating memory for score-at-a-time benchmark");
+            exit(EXIT_FAILURE);
+        }
+    }
+    size_t saved_budget = saat_postings_budget;
+    double saved_time_budget = saat_time_budget;
+    saat_time_budget = 0;
+    char *line = NULL;
+    size_t length = 0;
+    int query_id;
+    while (fscanf(batch, "%d ", &query_id) == 1 &&
+           getline(&line, &length, batch) != -1) {
+        arena_reset(&query_arena);
+        char *terms[MAX_TERMS];
+        size_t num_terms = parse_query(line, terms, DISJUNCTIVE);
+        PostingsList postings_lists[MAX_TERMS];
+        size_t valid_terms =
+            retrieve_postings_lists(terms, num_terms, postings_lists, index);
+        if (valid_terms == 0) {
+            continue;
+        }
+        if (num_queries == capacity) {
+            capacity *= 2;
+            for (size_t c = 0; c < num_configs; c++) {
+                seconds[c] = realloc(seconds[c], capacity * sizeof(double));
+                if (!seconds[c]) {
+                    perror("Error growing score-at-a-time benchmark times");
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+
+        // config 0 is d_DAAT, the reference top k
+        MinHeap exact;
+        init_min_heap(&exact, k);
+        double start = now_seconds();
+        d_DAAT(postings_lists, valid_terms, &exact);
+        seconds[0][num_queries] = now_seconds() - start;
+        for (size_t c = 1; c < num_configs; c++) {
+            MinHeap top_k;
+            init_min_heap(&top_k, k);
+            saat_postings_budget = budgets[c - 1];
+            start = now_seconds();
+            SAAT(postings_lists, valid_terms, &top_k);
+            seconds[c][num_queries] = now_seconds() - start;
+            // documents of the exact top k found, ties count as found
+            size_t found = 0;
+            for (size_t i = 0; i < exact.size; i++) {
+                for (size_t j = 0; j < top_k.size; j++) {
+                    if (top_k.nodes[j].doc_id == exact.nodes[i].doc_id ||
+                        (exact.nodes[i].score == exact.nodes[0].score &&
+                         top_k.nodes[j].score == exact.nodes[0].score)) {
+                        found++;
+                        break;
+                    }
+                }
+            }
+            recall[c] += exact.size ? (double)found / exact.size : 1;
+        }
+        num_queries++;
+    }
+    free(line);
+    fclose(batch);
+    saat_postings_budget = saved_budget;
+    saat_time_budget = saved_time_budget;
+    if (num_queries == 0) {
+        printf("No queries to run\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Score-at-a-time benchmark: %zu queries, top %zu\n", num_queries,
+           k);
+    for (size_t c = 0; c < num_configs; c++) {
+        double *times = seconds[c];
+        double total = 0;
+        for (size_t q = 0; q < num_queries; q++) {
+            total += times[q];
+        }
+        qsort(times, num_queries, sizeof(double), compare_doubles);
+        char label[64];
+        if (c == 0) {
+            snprintf(label, sizeof(label), "d_DAAT");
+        } else if (budgets[c - 1] == 0) {
+            snprintf(label, sizeof(label), "SAAT, no budget");
+        } else {
+            snprintf(label, sizeof(label), "SAAT, %zu postings",
+                     budgets[c - 1]);
+        }
+        printf("%-26s mean %9.1f us  p99 %9.1f us  max %9.1f us", label,
+               total * 1e6 / num_queries,
+               times[num_queries * 99 / 100] * 1e6,
+               times[num_queries - 1] * 1e6);
+        if (c > 0) {
+            printf("  recall %.3f", recall[c] / num_queries);
+        }
+        printf("\n");
+        free(seconds[c]);
+    }
+}
+
+// orders heap nodes by decreasing score, then by docID, so two top k lists
+// with the same documents and scores sort the same way
+int compare_results(const void *a, const void *b) {
+    const HeapNode *x = (const HeapNode *)a;
+    const HeapNode *y = (const HeapNode *)b;
+    if (x->score != y->score) {
+        return x->score < y->score ? 1 : -1;
+    }
+    return (x->doc_id > y->doc_id) - (x->doc_id < y->doc_id);
+}
+
+// whether a pruned top k is the exhaustive one: the same scores rank by rank
+// and the same documents, except that documents tied with the k-th score may
+// be swapped for each other. both lists are sorted by compare_results. scores
+// only differ in the order their terms were added
+int same_top_k(const MinHeap *exact, const MinHeap *pruned) {
+    if (exact->size != pruned->size) {
+        return 0;
+    }
+    if (exact->size == 0) {
+        return 1;
+    }
+    double last = exact->nodes[exact->size - 1].score;
+    for (size_t i = 0; i < exact->size; i++) {
+        double score = exact->nodes[i].score;
+        if (fabs(score - pruned->nodes[i].score) > 1e-9 * fabs(score)) {
+            return 0;
+        }
+        if (exact->nodes[i].doc_id != pruned->nodes[i].doc_id &&
+            fabs(score - last) > 1e-9 * fabs(last)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// check of the pruned disjunctive modes, run with ./proc -m verify <query
+// file> [k]. every query of a batch query file is evaluated with d_DAAT and
+// with bmw_DAAT and maxscore_DAAT on the same lists, which skip only
+// documents that cannot make the top k and so have to return the same top k.
+// the queries where they do not are reported, and the exit status is 1 if
+// there are any
+void verify_pruning(FILE *index, const char *filename, size_t k) {
+    FILE *batch = fopen(filename, "r");
+    if (!batch) {
+        perror("Error opening batch query file");
+        exit(EXIT_FAILURE);
+    }
+    const char *names[] = {"bmw_DAAT", "maxscore_DAAT"};
+    size_t mismatches[2] = {0};
+    size_t num_queries = 0;
+    char *line = NULL;
+    size_t length = 0;
+    int query_id;
+    while (fscanf(batch, "%d ", &query_id) == 1 &&
+           getline(&line, &length, batch) != -1) {
+        arena_reset(&query_arena);
+        char *terms[MAX_TERMS];
+        size_t num_terms = parse_query(line, terms, DISJUNCTIVE);
+        PostingsList postings_lists[MAX_TERMS];
+        size_t valid_terms =
+            retrieve_postings_lists(terms, num_terms, postings_lists, index);
+        if (valid_terms == 0) {
+            continue;
+        }
+        num_queries++;
+        MinHeap exact;
+        init_min_heap(&exact, k);
+        d_DAAT(postings_lists, valid_terms, &exact);
+        qsort(exact.nodes, exact.size, sizeof(HeapNode), compare_results);
+        for (int m = 0; m < 2; m++) {
+            MinHeap pruned;
+            init_min_heap(&pruned, k);
+            if (m == 0) {
+                bmw_DAAT(postings_lists, valid_terms, &pruned);
+            } else {
+                maxscore_DAAT(postings_lists, valid_terms, &pruned);
+            }
+            qsort(pruned.nodes, pruned.size, sizeof(HeapNode),
+                  compare_results);
+            if (same_top_k(&exact, &pruned)) {
+                continue;
+            }
+            if (mismatches[m]++ < 10) {
+                // the first rank where the two lists part
+                size_t i = 0;
+                while (i < exact.size && i < pruned.size &&
+                       exact.nodes[i].doc_id == pruned.nodes[i].doc_id &&
+                       exact.nodes[i].score == pruned.nodes[i].score) {
+                    i++;
+                }
+                printf("query %d: %s differs from d_DAAT at rank %zu", query_id,
+                       names[m], i + 1);
+                if (i < exact.size && i < pruned.size) {
+                    printf(" (DocID %d, Score %.9f instead of DocID %d, "
+                           "Score %.9f)",
+                           pruned.nodes[i].doc_id, pruned.nodes[i].score,
+                           exact.nodes[i].doc_id, exact.nodes[i].score);
+                } else {
+                    printf(" (%zu results instead of %zu)", pruned.size,
+                           exact.size);
+                }
+                printf("\n");
+            }
+        }
+    }
+    free(line);
+    fclose(batch);
+
+    printf("Verified %zu queries, top %zu\n", num_queries, k);
+    for (int m = 0; m < 2; m++) {
+        printf("%-14s %zu queries differ from d_DAAT\n", names[m],
+               mismatches[m]);
+    }
+    if (mismatches[0] || mismatches[1]) {
+        exit(EXIT_FAILURE);
     }
-    return 0;
 }
 
 int main(int argc, char *argv[]) {
-    // read in lexicon into memory in hash table
-    load_lexicon("lexicon_out");
+    init_streamvbyte_tables();
+
+    // leading options: -n scores with the 1-byte quantized norms, -M maps
+    // the index instead of reading each query's blocks, -A adds madvise
+    // hints to the mapping, and -P <postings> and -T <microseconds> set the
+    // budget of score-at-a-time queries
+    int use_index_map = 0;
+    while (argc > 1 && (!strcmp(argv[1], "-n") || !strcmp(argv[1], "-M") ||
+                        !strcmp(argv[1], "-A") || !strcmp(argv[1], "-P") ||
+                        !strcmp(argv[1], "-T"))) {
+        if (!strcmp(argv[1], "-P") || !strcmp(argv[1], "-T")) {
+            if (argc < 3) {
+                printf("Missing budget after %s\n", argv[1]);
+                exit(EXIT_FAILURE);
+            }
+            if (!strcmp(argv[1], "-P")) {
+                saat_postings_budget = strtoull(argv[2], NULL, 10);
+            } else {
+                saat_time_budget = atof(argv[2]) * 1e-6;
+            }
+            argv += 2;
+            argc -= 2;
+            continue;
+        }
+        if (!strcmp(argv[1], "-n")) {
+            use_norms = 1;
+        } else if (!strcmp(argv[1], "-M")) {
+            use_index_map = 1;
+        } else {
+            use_index_map = 1;
+            advise_index = 1;
+        }
+        argv++;
+        argc--;
+    }
+
+    // map the binary lexicon, or read the text one of older indexes
+    if (!map_lexicon("lexicon.bin")) {
+        load_lexicon("lexicon_out");
+    }
 
     // read document lengths into memory
-    load_doc_lengths("docs_out.txt");
+    if (!map_doc_table("docs.bin")) {
+        load_doc_lengths("docs_out.txt");
+    }
+    if (use_norms) {
+        map_norms("norms.bin");
+    }
+    build_doc_factors();
+    map_impacts("impacts.dat");
 
     // open index file
     FILE *index = fopen("final_index.dat", "rb");
+    if (!index) {
+        perror("Error opening final_index.dat");
+        exit(EXIT_FAILURE);
+    }
+    if (use_index_map) {
+        map_index(index);
+    }
+
+    // the last 8 bytes of the index tell where the skip tables start
+    if (index_version >= INDEX_VERSION_SKIPS) {
+        fseek(index, -(long)sizeof(size_t), SEEK_END);
+        if (fread(&skips_start, sizeof(size_t), 1, index) != 1) {
+            perror("Error reading skip tables offset");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // microbenchmarks, and the check of the pruned modes
+    if (argc > 2 && !strcmp(argv[1], "-m")) {
+        if (!strcmp(argv[2], "decode")) {
+            bench_decode(index, argc > 3 ? atoi(argv[3]) : 20);
+        } else if (!strcmp(argv[2], "seek")) {
+            bench_seek();
+        } else if (!strcmp(argv[2], "score")) {
+            bench_score();
+        } else if (!strcmp(argv[2], "taat") && argc > 3) {
+            bench_taat(index, argv[3], argc > 4 ? atoi(argv[4]) : 10);
+        } else if (!strcmp(argv[2], "saat") && argc > 3) {
+            bench_saat(index, argv[3], argc > 4 ? atoi(argv[4]) : 10);
+        } else if (!strcmp(argv[2], "verify") && argc > 3) {
+            verify_pruning(index, argv[3], argc > 4 ? atoi(argv[4]) : 10);
+        } else {
+            printf("Unknown benchmark: %s\n", argv[2]);
+            exit(EXIT_FAILURE);
+        }
+        exit(0);
+    }
 
     // added batch query processing for HW3
     if (argc > 1 && !strcmp(argv[1], "-b")) {
 
         if (argc == 2) {
-            printf("Usage: ./proc -b <query file> <num_results=10>\n");
+            printf("Usage: ./proc -b <query file> <num_results=10> "
+                   "<mode=d|w|m|t|s>\n");
             printf("No file of batch queries provided. Bye bye.\n");
             exit(EXIT_FAILURE);
         }
@@ -897,13 +4425,30 @@ int main(int argc, char *argv[]) {
         } else {
             num_results = atoi(argv[3]);
         }
+        // batch queries are disjunctive, 'w' runs them with block-max WAND,
+        // 'm' with MaxScore, 't' term-at-a-time and 's' score-at-a-time
+        int search_mode = DISJUNCTIVE;
+        if (argc > 4) {
+            if (strcasecmp(argv[4], "w") == 0) {
+                search_mode = BLOCK_MAX_WAND;
+            } else if (strcasecmp(argv[4], "m") == 0) {
+                search_mode = MAXSCORE;
+            } else if (strcasecmp(argv[4], "t") == 0) {
+                search_mode = TERM_AT_A_TIME;
+            } else if (strcasecmp(argv[4], "s") == 0) {
+                search_mode = SCORE_AT_A_TIME;
+            } else if (strcasecmp(argv[4], "d") != 0) {
+                printf("Unknown batch search mode: %s\n", argv[4]);
+                exit(EXIT_FAILURE);
+            }
+        }
         Query query;
         query.query = calloc(1024, sizeof(char));
         size_t qlen = 1024;
 
         while (fscanf(batch, "%d ", &query.id) != EOF) {
             getline(&query.query, &qlen, batch);
-            single_query(&query, num_results, DISJUNCTIVE, index, results);
+            single_query(&query, num_results, search_mode, index, results);
             memset(query.query, 0, qlen);
             query.id = 0;
         }
@@ -928,7 +4473,10 @@ int main(int argc, char *argv[]) {
     while (1) {
         // Prompt for search mode
         printf("\nEnter search mode - type 'c' for conjunctive, 'd' for "
-               "disjunctive, or 'q' if you want to quit: ");
+               "disjunctive, 'w' for disjunctive with block-max WAND, 'm' for "
+               "disjunctive with MaxScore, 't' for disjunctive term at a "
+               "time, 's' for disjunctive score at a time, or 'q' if you "
+               "want to quit: ");
         if (fgets(search_mode_input, sizeof(search_mode_input), stdin) ==
             NULL) {
             break; // Exit on EOF or error
@@ -942,11 +4490,20 @@ int main(int argc, char *argv[]) {
             search_mode = CONJUNCTIVE;
         } else if (strcasecmp(search_mode_input, "d") == 0) {
             search_mode = DISJUNCTIVE;
+        } else if (strcasecmp(search_mode_input, "w") == 0) {
+            search_mode = BLOCK_MAX_WAND;
+        } else if (strcasecmp(search_mode_input, "m") == 0) {
+            search_mode = MAXSCORE;
+        } else if (strcasecmp(search_mode_input, "t") == 0) {
+            search_mode = TERM_AT_A_TIME;
+        } else if (strcasecmp(search_mode_input, "s") == 0) {
+            search_mode = SCORE_AT_A_TIME;
         } else if (strcasecmp(search_mode_input, "q") == 0) {
             printf("Quitting the program.\n");
             break; // Exit the loop to quit the program
         } else {
-            printf("! Invalid search mode ! Please enter 'c' or 'd'.\n");
+            printf("! Invalid search mode ! Please enter 'c', 'd', 'w', 'm', "
+                   "'t' or 's'.\n");
             continue;
         }
 
@@ -957,19 +4514,12 @@ int main(int argc, char *argv[]) {
         }
         query[strcspn(query, "\n")] = '\0'; // Remove newline character
 
+        // release everything the previous query allocated
+        arena_reset(&query_arena);
+
         // Parse the query into individual terms
         char *terms[MAX_TERMS];
-        size_t num_terms = 0;
-        char *term =
-            strtok(query, " \t\n\r\f\v!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~");
-        while (term != NULL && num_terms < MAX_TERMS) {
-            parse_term(term);
-            if (strlen(term) > 0) {
-                terms[num_terms++] = strdup(term);
-            }
-            term =
-                strtok(NULL, " \t\n\r\f\v!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~");
-        }
+        size_t num_terms = parse_query(query, terms, search_mode);
 
         // Retrieve postings lists for all terms in query
         PostingsList postings_lists[num_terms];
@@ -985,26 +4535,30 @@ int main(int argc, char *argv[]) {
         printf("Performing search on %zu valid terms...\n", valid_terms);
         if (search_mode == CONJUNCTIVE) {
             c_DAAT(postings_lists, valid_terms, &top_k);
+        } else if (search_mode == BLOCK_MAX_WAND) {
+            bmw_DAAT(postings_lists, valid_terms, &top_k);
+        } else if (search_mode == MAXSCORE) {
+            maxscore_DAAT(postings_lists, valid_terms, &top_k);
+        } else if (search_mode == TERM_AT_A_TIME) {
+            TAAT(postings_lists, valid_terms, &top_k);
+        } else if (search_mode == SCORE_AT_A_TIME) {
+            SAAT(postings_lists, valid_terms, &top_k);
         } else {
             d_DAAT(postings_lists, valid_terms, &top_k);
         }
 
         // print top 10 results
         print_top_k(&top_k);
-        free_min_heap(&top_k);
-
-        // Free allocated memory for terms and postings lists
-        for (size_t i = 0; i < valid_terms; i++) {
-            free(terms[i]);
-            free(postings_lists[i].compressed_d_list);
-            free(postings_lists[i].compressed_f_list);
-        }
     }
 
     printf("Goodbye!\n");
     // Close index file
+    if (index_map) {
+        munmap(index_map, index_map_size);
+    }
     fclose(index);
     free_lexicon();
+    arena_free(&query_arena);
 
     return 0;
 }